@@ -378,6 +378,7 @@ setup_paging:
     ;   Bit 1: Read/Write (1 = schreibbar)
     ;   Bit 2: User/Supervisor (0 = nur Ring 0)
     ;   Bit 7: Page Size (1 = 2MB Page in PD, 1GB in PDPT)
+    ;   Bit 8: Global (bleibt bei CR3-Wechsel im TLB, sobald der Kernel CR4.PGE setzt)
 
     ; PML4[0] → PDPT
     mov eax, pdpt_table
@@ -392,7 +393,7 @@ setup_paging:
     ; PD: 512 Einträge für 512 * 2MB = 1GB Identity Mapping
     ; Das reicht für Bootloader + Kernel + Stack + PMM Bitmap + Heap
     mov edi, pd_table
-    mov eax, 0b10000011         ; Present + Writable + Page Size (2MB)
+    mov eax, 0b110000011        ; Present + Writable + Page Size (2MB) + Global
     mov ecx, 512                ; 512 Einträge
 
 .fill_pd:
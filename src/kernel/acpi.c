@@ -0,0 +1,323 @@
+/**
+ * Copyright (c) 2026 KibaOfficial
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+#include "acpi.h"
+#include "vga.h"
+#include "mm/vmm.h"
+
+/* =============================================================================
+ * Tabellen-Strukturen
+ * =============================================================================
+ */
+
+// Root System Description Pointer (ACPI 2.0+ Format, v1 endet nach rsdt_address)
+typedef struct {
+    char signature[8];           // "RSD PTR "
+    uint8_t checksum;            // Checksumme über die ersten 20 Bytes
+    char oem_id[6];
+    uint8_t revision;            // 0 = ACPI 1.0, 2 = ACPI 2.0+
+    uint32_t rsdt_address;
+    uint32_t length;             // Ab hier nur ACPI 2.0+
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;   // Checksumme über length Bytes
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+// SRAT: Header, 12 Bytes reserviert, dann variable Einträge (type, length, ...)
+#define SRAT_ENTRIES_OFFSET  48
+
+#define SRAT_TYPE_CPU        0   // Processor Local APIC Affinity (16 Bytes)
+#define SRAT_TYPE_MEMORY     1   // Memory Affinity (40 Bytes)
+#define SRAT_TYPE_X2APIC     2   // Processor Local x2APIC Affinity (24 Bytes)
+
+#define SRAT_FLAG_ENABLED    (1 << 0)
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t proximity_lo;        // Bits 0-7 der Proximity Domain
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_hi[3];     // Bits 8-31 der Proximity Domain
+    uint32_t clock_domain;
+} __attribute__((packed)) srat_cpu_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint32_t proximity;
+    uint16_t reserved1;
+    uint64_t base;
+    uint64_t length_bytes;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__((packed)) srat_memory_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint16_t reserved1;
+    uint32_t proximity;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed)) srat_x2apic_t;
+
+// Nur das erste GB ist beim Boot identisch gemappt
+#define ACPI_IDENTITY_LIMIT 0x40000000ULL
+
+/*
+ * Frühes Fenster für Tabellen oberhalb des Identity-Mappings (QEMU legt sie
+ * ans Ende des unteren RAMs, ab ~1 GB RAM also darüber). Vor vmm_init()
+ * gibt es keine Direct Map, deshalb hängt ein statisches PD in PDPT[1] der
+ * Boot-Tabellen - virtuell direkt hinter dem ersten GB. Ein Slot sind zwei
+ * 2 MB Pages, damit eine Tabelle eine 2 MB Grenze überspannen darf: Slot 0
+ * hält RSDT/XSDT, Slot 1 die zuletzt gesuchte Tabelle.
+ */
+#define ACPI_2MB            0x200000ULL
+#define ACPI_WINDOW_BASE    ACPI_IDENTITY_LIMIT
+#define ACPI_SLOT_ROOT      0
+#define ACPI_SLOT_TABLE     1
+
+/* =============================================================================
+ * Globale Variablen
+ * =============================================================================
+ */
+
+static uint64_t root_phys = 0;                  // RSDT oder XSDT
+static bool root_is_xsdt = false;
+
+static uint64_t acpi_window_pd[512] __attribute__((aligned(4096)));
+static bool acpi_window_active = false;
+
+/* =============================================================================
+ * Helper
+ * =============================================================================
+ */
+
+static bool acpi_checksum_ok(const void *data, uint32_t length) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+static bool acpi_signature_is(const char *a, const char *b, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// PDPT für die unteren 512 GB in den Boot-Tabellen (liegen im Identity-Mapping)
+static uint64_t* acpi_boot_pdpt(void) {
+    uint64_t *pml4 = (uint64_t*)(vmm_get_cr3() & PTE_ADDR_MASK);
+    return (uint64_t*)(pml4[0] & PTE_ADDR_MASK);
+}
+
+// phys im frühen Fenster (Slot slot) einblenden
+static void* acpi_window_map(uint64_t phys, uint32_t slot) {
+    uint64_t *pdpt = acpi_boot_pdpt();
+    if (!acpi_window_active) {
+        if (pdpt[1] & PAGE_PRESENT) {
+            return NULL;  // Boot-Tabellen mappen hier schon etwas
+        }
+        pdpt[1] = (uint64_t)acpi_window_pd | PAGE_PRESENT | PAGE_WRITE;
+        acpi_window_active = true;
+    }
+
+    uint64_t base = phys & ~(ACPI_2MB - 1);
+    uint64_t virt = ACPI_WINDOW_BASE + slot * 2 * ACPI_2MB;
+    for (uint32_t i = 0; i < 2; i++) {
+        acpi_window_pd[slot * 2 + i] = (base + i * ACPI_2MB) | PAGE_PRESENT | PAGE_WRITE | PAGE_HUGE;
+        vmm_invlpg(virt + i * ACPI_2MB);
+    }
+    return (void*)(virt + (phys - base));
+}
+
+// [phys, phys + length) lesbar machen: Direct Map, Identity-Mapping oder frühes Fenster
+static void* acpi_map(uint64_t phys, uint64_t length, uint32_t slot) {
+    if (vmm_direct_map_offset) {
+        return phys_to_virt(phys);
+    }
+    if (phys + length <= ACPI_IDENTITY_LIMIT) {
+        return (void*)phys;
+    }
+    if (length > ACPI_2MB) {
+        return NULL;
+    }
+
+    void *virt = acpi_window_map(phys, slot);
+    if (!virt) {
+        vga_print("[ACPI] WARNUNG: Tabelle bei ");
+        vga_print_hex(phys);
+        vga_println(" nicht erreichbar (ueber 1 GB, kein Fenster)");
+    }
+    return virt;
+}
+
+// Tabelle an einer physischen Adresse prüfen (erreichbar, Länge, Checksumme)
+static acpi_sdt_header_t* acpi_map_table(uint64_t phys, uint32_t slot) {
+    if (phys == 0) {
+        return NULL;
+    }
+
+    acpi_sdt_header_t *table = acpi_map(phys, sizeof(acpi_sdt_header_t), slot);
+    if (!table) {
+        return NULL;
+    }
+    uint32_t length = table->length;
+    if (length < sizeof(acpi_sdt_header_t)) {
+        return NULL;
+    }
+
+    // Erst mit der Länge steht fest, ob die Tabelle über die 1 GB Grenze reicht
+    table = acpi_map(phys, length, slot);
+    if (!table || !acpi_checksum_ok(table, length)) {
+        return NULL;
+    }
+    return table;
+}
+
+// RSDP in [start, end) suchen (16-Byte Schritte)
+static acpi_rsdp_t* acpi_scan_rsdp(uint64_t start, uint64_t end) {
+    for (uint64_t addr = start; addr + 20 <= end; addr += 16) {
+        acpi_rsdp_t *rsdp = (acpi_rsdp_t*)addr;
+        if (acpi_signature_is(rsdp->signature, "RSD PTR ", 8) && acpi_checksum_ok(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/* =============================================================================
+ * Public Funktionen
+ * =============================================================================
+ */
+
+bool acpi_init(void) {
+    // EBDA-Segment steht im BIOS Data Area bei 0x40E. Die Adresse läuft durch
+    // ein leeres asm, sonst hält gcc Zugriffe unter 4 KB für NULL-Dereferenzen
+    uint64_t bda = 0x400;
+    __asm__("" : "+r"(bda));
+    uint64_t ebda = (uint64_t)(*(uint16_t*)(bda + 0x0E)) << 4;
+
+    acpi_rsdp_t *rsdp = NULL;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    }
+    if (!rsdp) {
+        rsdp = acpi_scan_rsdp(0xE0000, 0x100000);
+    }
+    if (!rsdp) {
+        return false;
+    }
+
+    // XSDT bevorzugen, wenn vorhanden und gültig
+    if (rsdp->revision >= 2 && acpi_checksum_ok(rsdp, rsdp->length) &&
+        acpi_map_table(rsdp->xsdt_address, ACPI_SLOT_ROOT)) {
+        root_phys = rsdp->xsdt_address;
+        root_is_xsdt = true;
+    } else if (acpi_map_table(rsdp->rsdt_address, ACPI_SLOT_ROOT)) {
+        root_phys = rsdp->rsdt_address;
+    }
+    return root_phys != 0;
+}
+
+void acpi_early_done(void) {
+    if (acpi_window_active) {
+        acpi_boot_pdpt()[1] = 0;
+        acpi_window_active = false;
+        for (uint32_t i = 0; i < 4; i++) {
+            acpi_window_pd[i] = 0;
+            vmm_invlpg(ACPI_WINDOW_BASE + i * ACPI_2MB);
+        }
+    }
+}
+
+acpi_sdt_header_t* acpi_find_table(const char *signature) {
+    acpi_sdt_header_t *root_table = acpi_map_table(root_phys, ACPI_SLOT_ROOT);
+    if (!root_table) {
+        return NULL;
+    }
+
+    uint32_t entry_size = root_is_xsdt ? 8 : 4;
+    uint32_t count = (root_table->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    uint8_t *entries = (uint8_t*)root_table + sizeof(acpi_sdt_header_t);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = root_is_xsdt ? *(uint64_t*)(entries + i * 8)
+                                     : *(uint32_t*)(entries + i * 4);
+        acpi_sdt_header_t *table = acpi_map_table(phys, ACPI_SLOT_TABLE);
+        if (table && acpi_signature_is(table->signature, signature, 4)) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+uint32_t acpi_srat_memory(acpi_mem_affinity_t *out, uint32_t max) {
+    acpi_sdt_header_t *srat = acpi_find_table("SRAT");
+    if (!srat) {
+        return 0;
+    }
+
+    uint32_t count = 0;
+    uint8_t *end = (uint8_t*)srat + srat->length;
+    uint8_t *entry = (uint8_t*)srat + SRAT_ENTRIES_OFFSET;
+
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        if (entry[0] == SRAT_TYPE_MEMORY && entry[1] >= sizeof(srat_memory_t)) {
+            srat_memory_t *mem = (srat_memory_t*)entry;
+            if ((mem->flags & SRAT_FLAG_ENABLED) && mem->length_bytes && count < max) {
+                out[count].base = mem->base;
+                out[count].length = mem->length_bytes;
+                out[count].proximity = mem->proximity;
+                count++;
+            }
+        }
+        entry += entry[1];
+    }
+    return count;
+}
+
+bool acpi_srat_cpu_proximity(uint32_t apic_id, uint32_t *proximity) {
+    acpi_sdt_header_t *srat = acpi_find_table("SRAT");
+    if (!srat) {
+        return false;
+    }
+
+    uint8_t *end = (uint8_t*)srat + srat->length;
+    uint8_t *entry = (uint8_t*)srat + SRAT_ENTRIES_OFFSET;
+
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        if (entry[0] == SRAT_TYPE_CPU && entry[1] >= sizeof(srat_cpu_t)) {
+            srat_cpu_t *cpu = (srat_cpu_t*)entry;
+            if ((cpu->flags & SRAT_FLAG_ENABLED) && cpu->apic_id == apic_id) {
+                *proximity = cpu->proximity_lo |
+                             ((uint32_t)cpu->proximity_hi[0] << 8) |
+                             ((uint32_t)cpu->proximity_hi[1] << 16) |
+                             ((uint32_t)cpu->proximity_hi[2] << 24);
+                return true;
+            }
+        } else if (entry[0] == SRAT_TYPE_X2APIC && entry[1] >= sizeof(srat_x2apic_t)) {
+            srat_x2apic_t *cpu = (srat_x2apic_t*)entry;
+            if ((cpu->flags & SRAT_FLAG_ENABLED) && cpu->x2apic_id == apic_id) {
+                *proximity = cpu->proximity;
+                return true;
+            }
+        }
+        entry += entry[1];
+    }
+    return false;
+}
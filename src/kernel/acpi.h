@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2026 KibaOfficial
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+#ifndef KIOS_ACPI_H
+#define KIOS_ACPI_H
+
+#include "types.h"
+
+/* =============================================================================
+ * ACPI (Advanced Configuration and Power Interface) - Tabellen
+ * =============================================================================
+ * Die Firmware hinterlegt Beschreibungstabellen im RAM. Einstieg ist der
+ * RSDP ("RSD PTR "), den das BIOS in den ersten 1 KB der EBDA oder im
+ * Bereich 0xE0000 - 0xFFFFF ablegt (16-Byte ausgerichtet). Er zeigt auf:
+ *   - RSDT: Liste von 32-Bit Tabellenadressen (ACPI 1.0)
+ *   - XSDT: Liste von 64-Bit Tabellenadressen (ACPI 2.0+, bevorzugt)
+ *
+ * Jede Tabelle beginnt mit einem gemeinsamen Header (Signatur, Länge,
+ * Checksumme). Bisher brauchen wir nur die SRAT (System Resource Affinity
+ * Table), die Speicherbereiche und CPUs NUMA-Knoten (Proximity Domains)
+ * zuordnet - unter QEMU z.B. mit "-numa node,memdev=...".
+ *
+ * Tabellen im ersten GB werden über das Identity-Mapping gelesen, darüber
+ * vor vmm_init() über ein frühes Fenster in den Boot-Tabellen und danach
+ * über die Direct Map.
+ */
+
+// Gemeinsamer Header aller System Description Tables
+typedef struct {
+    char signature[4];           // z.B. "SRAT", "APIC", "FACP"
+    uint32_t length;             // Länge inkl. Header
+    uint8_t revision;
+    uint8_t checksum;            // Summe aller Bytes = 0
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+// Speicherbereich mit NUMA-Zuordnung aus der SRAT
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t proximity;          // Proximity Domain (Knoten-ID der Firmware)
+} acpi_mem_affinity_t;
+
+/* =============================================================================
+ * Funktionen
+ * =============================================================================
+ */
+
+/**
+ * acpi_init - Sucht RSDP und RSDT/XSDT
+ *
+ * Muss vor pmm_init() laufen, damit der PMM die SRAT auswerten kann.
+ *
+ * @return true wenn gültige ACPI-Tabellen gefunden wurden
+ */
+bool acpi_init(void);
+
+/**
+ * acpi_early_done - Baut das frühe Fenster für Tabellen über 1 GB ab
+ *
+ * Muss vor vmm_init() laufen: Das Fenster liegt dort, wo später der
+ * User-Bereich beginnt. Danach liest ACPI über die Direct Map.
+ */
+void acpi_early_done(void);
+
+/**
+ * acpi_find_table - Sucht eine Tabelle anhand ihrer Signatur
+ *
+ * Liegt die Tabelle vor vmm_init() über 1 GB, bleibt der Zeiger nur bis
+ * zum nächsten Aufruf gültig (das frühe Fenster wird neu belegt).
+ *
+ * @param signature 4-Zeichen Signatur (z.B. "SRAT")
+ * @return Zeiger auf den Tabellen-Header oder NULL
+ */
+acpi_sdt_header_t* acpi_find_table(const char *signature);
+
+/**
+ * acpi_srat_memory - Liest die aktivierten Memory-Affinity Einträge der SRAT
+ *
+ * @param out Ziel-Array
+ * @param max Kapazität von out
+ * @return Anzahl gefundener Bereiche (0 = keine SRAT / kein NUMA)
+ */
+uint32_t acpi_srat_memory(acpi_mem_affinity_t *out, uint32_t max);
+
+/**
+ * acpi_srat_cpu_proximity - Proximity Domain einer CPU (Local APIC ID)
+ *
+ * @param apic_id Local APIC ID der CPU
+ * @param proximity Ergebnis
+ * @return true wenn die SRAT einen aktivierten Eintrag für die CPU hat
+ */
+bool acpi_srat_cpu_proximity(uint32_t apic_id, uint32_t *proximity);
+
+#endif /* KIOS_ACPI_H */
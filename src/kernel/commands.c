@@ -17,6 +17,7 @@ const shell_command_t shell_commands[] = {
     {"mmap",    cmd_mmap,    "Show physical memory map"},
     {"meminfo", cmd_meminfo, "Show detailed memory statistics"},
     {"memtest", cmd_memtest, "Run comprehensive memory stress tests"},
+    {"slabinfo",cmd_slabinfo,"Show object cache statistics"},
     {"time",    cmd_time,    "Show current time"},
     {"uptime",  cmd_uptime,  "Show system uptime"},
     {"tasks",   cmd_tasks,   "List all running tasks"},
@@ -26,7 +27,8 @@ const shell_command_t shell_commands[] = {
     {"netconf", cmd_netconf,  "Configure network interface"},
     {"fault",   cmd_fault,   "Trigger CPU exceptions for testing (usage: fault <div0|ud|pf>)"},
     {"vmtest",  cmd_vmtest,  "Test Virtual Memory Manager"},
-    {"usertest",cmd_usertest,"Test Ring 3 / User Mode transition"}
+    {"usertest",cmd_usertest,"Test Ring 3 / User Mode transition"},
+    {"tlbtest", cmd_tlbtest, "Measure TLB refill cost after CR3 reloads"}
 };
 
 const int shell_commands_count = sizeof(shell_commands) / sizeof(shell_commands[0]);
@@ -23,7 +23,9 @@ void cmd_fault(const char* args);
 void cmd_mmap(const char* args);
 void cmd_vmtest(const char* args);
 void cmd_meminfo(const char* args);
+void cmd_slabinfo(const char* args);
 void cmd_memtest(const char* args);
 void cmd_usertest(const char* args);
+void cmd_tlbtest(const char* args);
 
 #endif /* KIOS_COMMANDS_H */
@@ -3,6 +3,7 @@
 #include "../mm/pmm.h"
 #include "../mm/vmm.h"
 #include "../mm/heap.h"
+#include "../mm/vmalloc.h"
 
 void cmd_meminfo(const char* args) {
     (void)args;
@@ -43,6 +44,98 @@ void cmd_meminfo(const char* args) {
     vga_print_dec(usage_percent);
     vga_println("%");
 
+    // Freie Pages pro Zone
+    for (uint32_t zone = 0; zone < PMM_ZONE_COUNT; zone++) {
+        vga_print("  Zone ");
+        vga_print(pmm_zone_name(zone));
+        vga_print(": ");
+        vga_print_dec(pmm_zone_free_pages(zone));
+        vga_print(" / ");
+        vga_print_dec(pmm_zone_present_pages(zone));
+        vga_println(" pages free");
+    }
+
+    // Pages pro NUMA-Knoten (ohne SRAT nur Knoten 0)
+    for (uint32_t node = 0; node < pmm_node_count(); node++) {
+        vga_print("  Node ");
+        vga_print_dec(node);
+        vga_print(": ");
+        vga_print_dec(pmm_node_free_pages(node));
+        vga_print(" / ");
+        vga_print_dec(pmm_node_present_pages(node));
+        vga_print(" pages free");
+        if (node == pmm_local_node()) {
+            vga_print(" (local)");
+        }
+        vga_println("");
+    }
+
+    vga_print("  CMA:          ");
+    vga_print_dec(pmm_cma_free_pages());
+    vga_print(" / ");
+    vga_print_dec(pmm_cma_pages());
+    vga_print(" pages free at ");
+    vga_print_hex(pmm_cma_base());
+    vga_print(" (");
+    vga_print_dec(pmm_cma_allocs());
+    vga_println(" allocs)");
+
+    vga_print("  CPU Cache:    ");
+    vga_print_dec(pmm_cached_pages());
+    vga_println(" frames");
+
+    uint64_t zero_hits = pmm_zero_pool_hits();
+    uint64_t zero_total = zero_hits + pmm_zero_pool_misses();
+    vga_print("  Zero Pool:    ");
+    vga_print_dec(pmm_zero_pool_pages());
+    vga_print(" pages, ");
+    vga_print_dec(zero_total ? (zero_hits * 100) / zero_total : 0);
+    vga_print("% hit rate (");
+    vga_print_dec(zero_hits);
+    vga_print("/");
+    vga_print_dec(zero_total);
+    vga_println(")");
+
+    vga_print("  Init Cost:    ");
+    vga_print_dec(pmm_init_cycles());
+    vga_println(" cycles");
+
+    vga_print("  Alloc Latency: ");
+    vga_print_dec(pmm_alloc_avg_cycles());
+    vga_print(" cycles avg, ");
+    vga_print_dec(pmm_alloc_max_cycles());
+    vga_print(" max (");
+    vga_print_dec(pmm_alloc_calls());
+    vga_println(" calls)");
+
+    // Buddy Allocator: freie Blöcke pro Order
+    vga_print("  Free Blocks:  ");
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        vga_print_dec(order);
+        vga_print(":");
+        vga_print_dec(pmm_free_blocks(order));
+        vga_print(" ");
+    }
+    vga_println("");
+
+    // Fragmentierung: Anteil freier Pages, die für die Order zu klein liegen
+    vga_print("  Frag Index %: ");
+    for (uint32_t order = 1; order <= PMM_MAX_ORDER; order++) {
+        vga_print_dec(order);
+        vga_print(":");
+        vga_print_dec(pmm_frag_index(order));
+        vga_print(" ");
+    }
+    vga_println("");
+
+    vga_print("  Compaction:   ");
+    vga_print_dec(pmm_compact_success());
+    vga_print("/");
+    vga_print_dec(pmm_compact_runs());
+    vga_print(" runs ok, ");
+    vga_print_dec(pmm_compact_migrated());
+    vga_println(" pages migrated");
+
     vga_println("");
 
     // VMM Statistics
@@ -50,15 +143,73 @@ void cmd_meminfo(const char* args) {
     vga_println("");
 
     vga_print("  PML4 Address: ");
-    vga_print_hex(vmm_get_cr3());
+    vga_print_hex(vmm_get_cr3() & PTE_ADDR_MASK);
     vga_println("");
 
-    vga_print("  Page Size:    ");
-    vga_println("4 KB");
+    vga_print("  PCID:         ");
+    if (vmm_pcid_enabled()) {
+        vga_print("ASID ");
+        vga_print_dec(vmm_get_cr3() & CR3_PCID_MASK);
+        vga_print(", ");
+        vga_print_dec(vmm_cr3_noflush_switches());
+        vga_print("/");
+        vga_print_dec(vmm_cr3_switches());
+        vga_println(" switches without flush");
+    } else {
+        vga_println("not supported");
+    }
+
+    vga_print("  Direct Map:   ");
+    vga_print_hex(VMM_DIRECT_MAP_BASE);
+    vga_println("");
+
+    vga_print("  Page Sizes:   ");
+    vga_println(vmm_has_1gb_pages() ? "4 KB, 2 MB, 1 GB" : "4 KB, 2 MB");
+
+    vga_print("  Cache Modes:  ");
+    vga_println(vmm_pat_enabled() ? "WB, WT, UC, WC (PAT)" : "WB, WT, UC");
+
+    vga_print("  Large Pages:  ");
+    vga_print_dec(vmm_huge_maps());
+    vga_print(" mapped, ");
+    vga_print_dec(vmm_leaf_splits());
+    vga_println(" split");
+
+    vga_print("  Demand Paged: ");
+    vga_print_dec(vmm_demand_faults());
+    vga_println(" pages");
+
+    vga_print("  Copy-on-Write: ");
+    vga_print_dec(vmm_cow_copies());
+    vga_print(" copied, ");
+    vga_print_dec(vmm_cow_reuses());
+    vga_println(" reused");
+
+    vga_print("  Page Tables:  ");
+    vga_print_dec(vmm_pt_frames());
+    vga_print(" frames, ");
+    vga_print_dec(vmm_pt_reclaimed());
+    vga_println(" reclaimed");
+
+    vga_print("  Vmalloc:      ");
+    vga_print_dec(vmalloc_areas());
+    vga_print(" areas, ");
+    vga_print_dec(vmalloc_used_pages());
+    vga_print(" pages, ");
+    vga_print_dec(vmalloc_lazy_pages());
+    vga_print(" lazy (");
+    vga_print_dec(vmalloc_purges());
+    vga_println(" purges)");
 
     vga_print("  Levels:       ");
     vga_println("4 (PML4 -> PDPT -> PD -> PT)");
 
+    vga_print("  TLB Flushes:  ");
+    vga_print_dec(vmm_tlb_full_flushes());
+    vga_print(" full, ");
+    vga_print_dec(vmm_tlb_page_flushes());
+    vga_println(" invlpg");
+
     vga_println("");
 
     // Heap Statistics
@@ -80,6 +231,22 @@ void cmd_meminfo(const char* args) {
     vga_print_dec(heap_size);
     vga_println(" bytes");
 
+    vga_print("  Window:       ");
+    vga_print_dec(heap_window_size() / (1024 * 1024));
+    vga_print(" / ");
+    vga_print_dec(HEAP_MAX_SIZE / (1024 * 1024));
+    vga_println(" MB reserved");
+
+    vga_print("  Slabs:        ");
+    vga_print_dec(heap_slabs());
+    vga_print(" (");
+    vga_print_dec(heap_empty_slabs());
+    vga_print(" empty), ");
+    vga_print_dec(heap_released_slabs());
+    vga_print(" released, ");
+    vga_print_dec(heap_reclaimed_pages());
+    vga_println(" pages reclaimed");
+
     // Heap pages mapped
     uint64_t heap_pages = (heap_size + 4095) / 4096;
     vga_print("  Pages Mapped: ");
@@ -3,10 +3,18 @@
 #include "../mm/pmm.h"
 #include "../mm/vmm.h"
 #include "../mm/heap.h"
+#include "../mm/vmalloc.h"
 
 #define TEST_PAGES 50
 #define TEST_HEAP_ALLOCS 100
 
+// Konstruktor für Test 11: markiert jedes Objekt genau einmal
+static uint32_t test_ctor_calls;
+static void test_ctor(void* obj) {
+    ((uint64_t*)obj)[0] = 0xC7C7C7C7C7C7C7C7ULL;
+    test_ctor_calls++;
+}
+
 void cmd_memtest(const char* args) {
     (void)args;
 
@@ -41,13 +49,19 @@ void cmd_memtest(const char* args) {
     vga_print_dec(TEST_PAGES);
     vga_println(" pages...");
 
-    uint64_t virt_base = 0xFFFF900000000000ULL;
+    // 4 MB Adressbereich: Test 2-4 vorne, Test 9 braucht ein 2 MB Fenster
+    uint64_t virt_base = (uint64_t)get_vm_area(2 * VMM_2MB, VMM_2MB);
+    if (!virt_base || !vmm_map_pages(&vmm_kernel_space, virt_base, pages, TEST_PAGES, PAGE_PRESENT | PAGE_WRITE)) {
+        vga_print_colored("  [FAIL] Could not map pages!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+
     for (int i = 0; i < TEST_PAGES; i++) {
         uint64_t virt_addr = virt_base + (i * 0x1000);
-        vmm_map_page(virt_addr, (uint64_t)pages[i], PAGE_PRESENT | PAGE_WRITE);
 
         // Verify mapping
-        uint64_t resolved = vmm_virt_to_phys(virt_addr);
+        uint64_t resolved = vmm_virt_to_phys(&vmm_kernel_space, virt_addr);
         if (resolved != (uint64_t)pages[i]) {
             vga_print_colored("  [FAIL] Mapping mismatch at page ", VGA_LIGHT_RED, VGA_BLACK);
             vga_print_dec(i);
@@ -97,12 +111,13 @@ void cmd_memtest(const char* args) {
     vga_print_dec(TEST_PAGES);
     vga_println(" pages...");
 
+    vmm_unmap_range(&vmm_kernel_space, virt_base, TEST_PAGES * 0x1000);
+
     for (int i = 0; i < TEST_PAGES; i++) {
         uint64_t virt_addr = virt_base + (i * 0x1000);
-        vmm_unmap_page(virt_addr);
 
         // Verify unmapped
-        uint64_t resolved = vmm_virt_to_phys(virt_addr);
+        uint64_t resolved = vmm_virt_to_phys(&vmm_kernel_space, virt_addr);
         if (resolved != 0) {
             vga_print_colored("  [FAIL] Page still mapped at ", VGA_LIGHT_RED, VGA_BLACK);
             vga_print_dec(i);
@@ -163,9 +178,244 @@ void cmd_memtest(const char* args) {
             }
         }
     }
+    // Freigeben: der zuletzt freigegebene Block muss als nächster zurückkommen
+    vga_println("  Freeing heap blocks...");
+    for (int i = 0; i < TEST_HEAP_ALLOCS; i++) {
+        kfree(heap_ptrs[i]);
+    }
+    void* reused = kmalloc(200);   // Gleiche Size Class (256)
+    kfree(reused);
+    if (reused != heap_ptrs[TEST_HEAP_ALLOCS - 1] || ((uint64_t)reused & 15)) {
+        vga_print_colored("  [FAIL] Freed block not reused!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+
+    // Große Anforderungen gehen direkt an den Buddy Allocator
+    uint64_t used_large = pmm_used_pages();
+    void* large_buf = kmalloc(3 * 4096);
+    if (!large_buf || pmm_used_pages() != used_large + 4) {
+        vga_print_colored("  [FAIL] Large kmalloc not served by PMM!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    kfree(large_buf);
+    if (pmm_used_pages() != used_large) {
+        vga_print_colored("  [FAIL] Large kfree did not return pages!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
     vga_print_colored("  [PASS] Heap test successful!", VGA_LIGHT_GREEN, VGA_BLACK);
     vga_println("");
 
+    // Test 7: Buddy Allocator (zusammenhängende Pages)
+    vga_print_colored("Test 7: Contiguous Page Allocation", VGA_YELLOW, VGA_BLACK);
+    vga_println("");
+    vga_println("  Allocating order-4 block (16 pages)...");
+
+    uint64_t used_before = pmm_used_pages();
+    void* block = pmm_alloc_pages(4);
+    if (!block || ((uint64_t)block & (16 * 0x1000 - 1))) {
+        vga_print_colored("  [FAIL] Block missing or misaligned!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    pmm_free_pages(block, 4);
+    if (pmm_used_pages() != used_before) {
+        vga_print_colored("  [FAIL] Block not returned on free!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    vga_print_colored("  [PASS] Block allocated, aligned and coalesced!", VGA_LIGHT_GREEN, VGA_BLACK);
+    vga_println("");
+
+    // Test 8: CMA (große zusammenhängende Puffer jenseits der Buddy-Order)
+    vga_print_colored("Test 8: CMA Allocation", VGA_YELLOW, VGA_BLACK);
+    vga_println("");
+    if (pmm_cma_pages() < 1536) {
+        vga_println("  CMA area too small, skipped");
+    } else {
+        vga_println("  Allocating 6 MB (1536 pages) from CMA...");
+
+        used_before = pmm_used_pages();
+        void* buffer = pmm_cma_alloc(1536);
+        if (!buffer || (uint64_t)buffer < pmm_cma_base()) {
+            vga_print_colored("  [FAIL] CMA allocation failed!", VGA_LIGHT_RED, VGA_BLACK);
+            vga_println("");
+            return;
+        }
+        pmm_cma_free(buffer, 1536);
+        if (pmm_used_pages() != used_before) {
+            vga_print_colored("  [FAIL] CMA buffer not returned on free!", VGA_LIGHT_RED, VGA_BLACK);
+            vga_println("");
+            return;
+        }
+        vga_print_colored("  [PASS] CMA buffer allocated and released!", VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_println("");
+    }
+
+    // Test 9: 2 MB Page (ein PD-Leaf statt 512 PTEs)
+    vga_print_colored("Test 9: Large Page Mapping", VGA_YELLOW, VGA_BLACK);
+    vga_println("");
+    vga_println("  Mapping order-9 block as one 2 MB page...");
+
+    void* large = pmm_alloc_pages(9);
+    uint64_t large_virt = virt_base + 0x200000;
+    if (!large || !vmm_map_range(&vmm_kernel_space, large_virt, (uint64_t)large, 0x200000, PAGE_PRESENT | PAGE_WRITE)) {
+        vga_print_colored("  [FAIL] Could not map 2 MB page!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    if (vmm_virt_to_phys(&vmm_kernel_space, large_virt + 0x12345) != (uint64_t)large + 0x12345) {
+        vga_print_colored("  [FAIL] 2 MB translation mismatch!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    *(uint64_t*)(large_virt + 0x6000) = 0xDEADBEEFCAFEBABEULL;
+
+    // Einzelne Page entfernen: das Leaf wird in 4 KB Pages aufgeteilt
+    vmm_unmap_page(&vmm_kernel_space, large_virt + 0x5000);
+    if (vmm_virt_to_phys(&vmm_kernel_space, large_virt + 0x5000) != 0 ||
+        *(uint64_t*)(large_virt + 0x6000) != 0xDEADBEEFCAFEBABEULL) {
+        vga_print_colored("  [FAIL] Split of 2 MB page failed!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    vmm_unmap_range(&vmm_kernel_space, large_virt, 0x200000);
+    pmm_free_pages(large, 9);
+
+    // Block gehört danach nur dem Mapping; erstes Kind zuerst entfernen -
+    // der Block muss bleiben, bis auch die übrigen 511 PTEs weg sind
+    large = pmm_alloc_pages(9);
+    if (!large || !vmm_map_range(&vmm_kernel_space, large_virt, (uint64_t)large, 0x200000, PAGE_PRESENT | PAGE_WRITE)) {
+        vga_print_colored("  [FAIL] Could not map 2 MB page!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    pmm_free_pages(large, 9);
+    *(uint64_t*)(large_virt + 0x6000) = 0xDEADBEEFCAFEBABEULL;
+
+    page_t* large_head = pmm_phys_to_page((uint64_t)large);
+    vmm_unmap_page(&vmm_kernel_space, large_virt);
+    if (!large_head->refcount || *(uint64_t*)(large_virt + 0x6000) != 0xDEADBEEFCAFEBABEULL) {
+        vga_print_colored("  [FAIL] Block freed while split children still map it!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    vmm_unmap_range(&vmm_kernel_space, large_virt, 0x200000);
+    if (large_head->refcount) {
+        vga_print_colored("  [FAIL] Block not released with the last child!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    free_vm_area((void*)virt_base);
+    vga_print_colored("  [PASS] 2 MB page mapped, translated and split!", VGA_LIGHT_GREEN, VGA_BLACK);
+    vga_println("");
+
+    // Test 10: vmalloc (virtuell zusammenhängend, physisch verstreut)
+    vga_print_colored("Test 10: vmalloc / vmap", VGA_YELLOW, VGA_BLACK);
+    vga_println("");
+    vga_println("  Allocating 64 KB with vmalloc...");
+
+    uint64_t* buffer = (uint64_t*)vmalloc(64 * 1024);
+    if (!buffer) {
+        vga_print_colored("  [FAIL] vmalloc failed!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    for (uint64_t i = 0; i < 8192; i++) {
+        buffer[i] = 0xC0FFEE0000000000ULL | i;
+    }
+
+    // Dieselben Frames ein zweites Mal mappen und über den Alias lesen
+    void* frames[16];
+    for (int i = 0; i < 16; i++) {
+        frames[i] = (void*)vmm_virt_to_phys(&vmm_kernel_space, (uint64_t)buffer + i * PAGE_SIZE);
+    }
+    uint64_t* alias = (uint64_t*)vmap(frames, 16, PAGE_WRITE);
+    if (!alias || alias == buffer || alias[8191] != (0xC0FFEE0000000000ULL | 8191) ||
+        vmm_virt_to_phys(&vmm_kernel_space, (uint64_t)buffer + 16 * PAGE_SIZE) != 0) {
+        vga_print_colored("  [FAIL] vmap alias or guard page wrong!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    vunmap(alias);
+    vfree(buffer);
+
+    // Nach dem Purge sind Frames und Adressbereich wieder frei
+    vmalloc_purge();
+    void* again = vmalloc(64 * 1024);
+    if (again != buffer) {
+        vga_print_colored("  [FAIL] Range not reused after purge!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    vfree(again);
+    vga_print_colored("  [PASS] vmalloc, vmap alias and lazy purge work!", VGA_LIGHT_GREEN, VGA_BLACK);
+    vga_println("");
+
+    // Test 11: Object Cache (Objekte kommen konstruiert zurück)
+    vga_print_colored("Test 11: Object Cache", VGA_YELLOW, VGA_BLACK);
+    vga_println("");
+
+    test_ctor_calls = 0;
+    kmem_cache_t* cache = kmem_cache_create("memtest", 40, KMEM_CACHE_LINE, test_ctor);
+    uint64_t* obj = cache ? (uint64_t*)kmem_cache_alloc(cache) : NULL;
+    if (!obj || ((uint64_t)obj & (KMEM_CACHE_LINE - 1)) || obj[0] != 0xC7C7C7C7C7C7C7C7ULL) {
+        vga_print_colored("  [FAIL] Object missing, misaligned or not constructed!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+
+    // Zurückgeben und neu holen: gleiches Objekt, Zustand erhalten, kein zweiter ctor
+    kmem_cache_free(cache, obj);
+    uint64_t* reobj = (uint64_t*)kmem_cache_alloc(cache);
+    if (reobj != obj || obj[0] != 0xC7C7C7C7C7C7C7C7ULL || test_ctor_calls != 1 || cache->hits != 1) {
+        vga_print_colored("  [FAIL] Constructed object not reused!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    kmem_cache_free(cache, reobj);
+    kmem_cache_destroy(cache);
+    vga_print_colored("  [PASS] Constructor state kept across free/alloc!", VGA_LIGHT_GREEN, VGA_BLACK);
+    vga_println("");
+
+    // Test 12: Heap Shrink (leere Slabs gehen an den PMM zurück)
+    vga_print_colored("Test 12: Heap Shrink", VGA_YELLOW, VGA_BLACK);
+    vga_println("");
+
+    // 8 Slabs mit je 7 Objekten a 2 KB komplett beschreiben
+    void* shrink_ptrs[56];
+    for (int i = 0; i < 56; i++) {
+        shrink_ptrs[i] = kmalloc(2048);
+        if (!shrink_ptrs[i]) {
+            vga_print_colored("  [FAIL] kmalloc failed!", VGA_LIGHT_RED, VGA_BLACK);
+            vga_println("");
+            return;
+        }
+        for (int j = 0; j < 2048; j += 64) {
+            ((uint8_t*)shrink_ptrs[i])[j] = (uint8_t)i;
+        }
+    }
+    for (int i = 0; i < 56; i++) {
+        kfree(shrink_ptrs[i]);
+    }
+
+    uint64_t shrunk = heap_shrink();
+    void* after = kmalloc(2048);   // Freigegebener Slot wird neu eingeblendet
+    if (shrunk < 28 || !after) {
+        vga_print_colored("  [FAIL] Empty slabs not returned!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        return;
+    }
+    ((uint8_t*)after)[2047] = 0x5A;
+    kfree(after);
+    vga_print("  Returned ");
+    vga_print_dec(shrunk);
+    vga_println(" pages to the PMM");
+    vga_print_colored("  [PASS] Heap shrink and refault work!", VGA_LIGHT_GREEN, VGA_BLACK);
+    vga_println("");
+
     // Summary
     vga_println("");
     vga_print_colored("=== All Tests Passed! ===", VGA_LIGHT_GREEN, VGA_BLACK);
@@ -1,5 +1,6 @@
 #include "vga.h"
 #include "types.h"
+#include "../mm/pmm.h"
 
 #define MEMORY_MAP_BASE 0x10000
 #define MEMORY_MAP_ENTRY_SIZE 24
@@ -36,4 +37,25 @@ void cmd_mmap(const char* args) {
         vga_println("");
     }
     vga_println("");
+
+    // NUMA-Knoten laut ACPI SRAT (ohne SRAT ein Knoten über den ganzen RAM)
+    vga_println("NUMA Nodes:");
+    for (uint32_t node = 0; node < pmm_node_count(); node++) {
+        vga_print("  Node ");
+        vga_print_dec(node);
+        vga_print(" (domain ");
+        vga_print_dec(pmm_node_proximity(node));
+        vga_print("): ");
+        vga_print_hex(pmm_node_start(node));
+        vga_print(" - ");
+        vga_print_hex(pmm_node_end(node));
+        vga_print(", ");
+        vga_print_dec(pmm_node_present_pages(node) * 4 / 1024);
+        vga_print(" MB usable");
+        if (node == pmm_local_node()) {
+            vga_print(" (local)");
+        }
+        vga_println("");
+    }
+    vga_println("");
 }
@@ -0,0 +1,60 @@
+#include "../commands.h"
+#include "../vga.h"
+#include "../mm/heap.h"
+
+// Mit Leerzeichen bis Spalte col auffüllen
+static void pad_to(int col) {
+    do {
+        vga_putchar(' ');
+    } while (vga_cursor_x < col);
+}
+
+void cmd_slabinfo(const char* args) {
+    (void)args;
+
+    vga_println("");
+    vga_println("=== Slab Caches ===");
+    vga_println("");
+    vga_println("Name            Size  Active  Slabs  Hits      Misses    Hit%");
+
+    for (kmem_cache_t* cache = kmem_cache_list(); cache; cache = cache->next) {
+        // Leere Caches (z.B. ungenutzte kmalloc Size Classes) überspringen
+        if (!cache->slabs && !cache->hits && !cache->misses) {
+            continue;
+        }
+
+        uint64_t total = cache->hits + cache->misses;
+        vga_print(cache->name);
+        pad_to(16);
+        vga_print_dec(cache->size);
+        pad_to(22);
+        vga_print_dec(cache->active);
+        pad_to(30);
+        vga_print_dec(cache->slabs);
+        pad_to(37);
+        vga_print_dec(cache->hits);
+        pad_to(47);
+        vga_print_dec(cache->misses);
+        pad_to(57);
+        vga_print_dec(total ? (cache->hits * 100) / total : 0);
+        vga_println("");
+    }
+
+    vga_println("");
+    vga_print("Slabs: ");
+    vga_print_dec(heap_slabs());
+    vga_print(" carved, ");
+    vga_print_dec(heap_empty_slabs());
+    vga_println(" empty");
+
+    uint64_t mag_hits = heap_magazine_hits();
+    uint64_t mag_total = mag_hits + heap_magazine_misses();
+    vga_print("Magazines: ");
+    vga_print_dec(mag_total ? (mag_hits * 100) / mag_total : 0);
+    vga_print("% of kmalloc/kfree on the CPU fast path (");
+    vga_print_dec(mag_hits);
+    vga_print("/");
+    vga_print_dec(mag_total);
+    vga_println(")");
+    vga_println("");
+}
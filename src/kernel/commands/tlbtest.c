@@ -0,0 +1,93 @@
+#include "../commands.h"
+#include "../vga.h"
+#include "../cpu.h"
+#include "../mm/vmm.h"
+#include "../mm/pmm.h"
+#include "../mm/vmalloc.h"
+
+#define TLB_TEST_PAGES  256
+#define TLB_TEST_ROUNDS 16
+
+// Jede Page einmal lesen und die Zyklen dafür messen
+static uint64_t touch_pages(uint64_t base) {
+    uint64_t start = rdtsc();
+    for (uint64_t i = 0; i < TLB_TEST_PAGES; i++) {
+        (void)*(volatile uint64_t*)(base + i * PAGE_SIZE);
+    }
+    return rdtsc() - start;
+}
+
+void cmd_tlbtest(const char* args) {
+    (void)args;
+
+    vga_println("");
+    vga_println("=== TLB Test ===");
+    vga_println("");
+
+    if (!vmm_global_enabled()) {
+        vga_println("  Global pages not enabled, skipped");
+        vga_println("");
+        return;
+    }
+
+    // Kernel-Mapping (global) auf einzelne 4 KB Pages
+    void* frames[TLB_TEST_PAGES];
+    uint32_t count = 0;
+    while (count < TLB_TEST_PAGES && (frames[count] = pmm_alloc_page())) {
+        count++;
+    }
+    uint64_t base = (uint64_t)get_vm_area(TLB_TEST_PAGES * PAGE_SIZE, PAGE_SIZE);
+    if (count < TLB_TEST_PAGES || !base ||
+        !vmm_map_pages(&vmm_kernel_space, base, frames, TLB_TEST_PAGES, PAGE_PRESENT | PAGE_WRITE)) {
+        vga_print_colored("  [FAIL] Could not map test pages!", VGA_LIGHT_RED, VGA_BLACK);
+        vga_println("");
+        while (count--) {
+            pmm_free_page(frames[count]);
+        }
+        free_vm_area((void*)base);
+        return;
+    }
+
+    vga_print("  Touching ");
+    vga_print_dec(TLB_TEST_PAGES);
+    vga_println(" kernel pages after each flush...");
+
+    // Ohne Interrupts messen, sonst verfälscht der Timer-IRQ die Zyklen
+    uint64_t irq = cpu_irq_save();
+    uint64_t kept = 0, lost = 0;
+    for (int round = 0; round < TLB_TEST_ROUNDS; round++) {
+        touch_pages(base);
+
+        // Wie ein Adressraum-Wechsel: globale Einträge bleiben
+        vmm_flush_tlb();
+        kept += touch_pages(base);
+
+        // Wie vorher ohne G-Bit: alles muss neu gewalkt werden
+        vmm_flush_tlb_global();
+        lost += touch_pages(base);
+    }
+    cpu_irq_restore(irq);
+
+    uint64_t per_kept = kept / (TLB_TEST_ROUNDS * TLB_TEST_PAGES);
+    uint64_t per_lost = lost / (TLB_TEST_ROUNDS * TLB_TEST_PAGES);
+
+    vga_print("  After CR3 reload (global kept): ");
+    vga_print_dec(per_kept);
+    vga_println(" cycles/page");
+    vga_print("  After full flush (no global):   ");
+    vga_print_dec(per_lost);
+    vga_println(" cycles/page");
+    vga_print("  Refill cost saved:              ");
+    vga_print_dec(per_lost > per_kept ? ((per_lost - per_kept) * 100) / per_lost : 0);
+    vga_println("%");
+
+    vmm_unmap_range(&vmm_kernel_space, base, TLB_TEST_PAGES * PAGE_SIZE);
+    free_vm_area((void*)base);
+    for (uint32_t i = 0; i < TLB_TEST_PAGES; i++) {
+        pmm_free_page(frames[i]);
+    }
+
+    vga_println("");
+    vga_println("=== TLB Test Complete ===");
+    vga_println("");
+}
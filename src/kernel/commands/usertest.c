@@ -9,76 +9,99 @@
 #include "../mm/vmm.h"
 #include "../mm/pmm.h"
 #include "../string.h"
+#include "../task.h"
 
 // Einfacher User-Code als Bytecode (Position Independent)
 // Dieser Code macht:
-//   1. sys_write(1, msg, 14) - schreibt "Hello Ring 3!\n"
-//   2. sys_exit(0) - beendet
+//   1. sys_fork() - ab hier laufen Eltern- und Kind-Prozess
+//   2. sys_write(1, msg, 14) - schreibt "Hello Ring 3!\n" (also zweimal)
+//   3. sys_exit(0) - beendet
 //
 // Bytecode Layout:
-//   Offset 0x00: lea rsi, [rip+X]  ; 7 bytes - X zeigt auf String
-//   Offset 0x07: mov rax, 1        ; 7 bytes
-//   Offset 0x0E: mov rdi, 1        ; 7 bytes
-//   Offset 0x15: mov rdx, 14       ; 7 bytes
-//   Offset 0x1C: syscall           ; 2 bytes
-//   Offset 0x1E: mov rax, 0        ; 7 bytes
+//   Offset 0x00: mov rax, 4        ; 7 bytes
+//   Offset 0x07: syscall           ; 2 bytes
+//   Offset 0x09: lea rsi, [rip+X]  ; 7 bytes - X zeigt auf String
+//   Offset 0x10: mov rax, 1        ; 7 bytes
+//   Offset 0x17: mov rdi, 1        ; 7 bytes
+//   Offset 0x1E: mov rdx, 14       ; 7 bytes
 //   Offset 0x25: syscall           ; 2 bytes
-//   Offset 0x27: jmp $             ; 2 bytes
-//   Offset 0x29: "Hello Ring 3!\n" ; 15 bytes (inkl. \0)
+//   Offset 0x27: mov rax, 0        ; 7 bytes
+//   Offset 0x2E: syscall           ; 2 bytes
+//   Offset 0x30: jmp $             ; 2 bytes
+//   Offset 0x32: "Hello Ring 3!\n" ; 15 bytes (inkl. \0)
 //
-// lea rsi, [rip+X] am Offset 0x00 zeigt nach seiner Ausführung auf Offset 0x07 (RIP nach lea)
-// Um auf 0x29 zu kommen: X = 0x29 - 0x07 = 0x22 = 34
+// lea rsi, [rip+X] am Offset 0x09 zeigt nach seiner Ausführung auf Offset 0x10 (RIP nach lea)
+// Um auf 0x32 zu kommen: X = 0x32 - 0x10 = 0x22 = 34
 static const uint8_t user_code[] = {
+    // --- sys_fork() ---
+    // mov rax, 4          ; SYS_FORK = 4
+    0x48, 0xc7, 0xc0, 0x04, 0x00, 0x00, 0x00,   // Offset 0x00-0x06
+    // syscall             ; Kind kehrt mit rax = 0 zurück
+    0x0f, 0x05,                                  // Offset 0x07-0x08
+
     // lea rsi, [rip+34]  ; buffer = message (RIP-relative)
-    0x48, 0x8d, 0x35, 0x22, 0x00, 0x00, 0x00,   // Offset 0x00-0x06
+    0x48, 0x8d, 0x35, 0x22, 0x00, 0x00, 0x00,   // Offset 0x09-0x0F
     // mov rax, 1          ; SYS_WRITE = 1
-    0x48, 0xc7, 0xc0, 0x01, 0x00, 0x00, 0x00,   // Offset 0x07-0x0D
+    0x48, 0xc7, 0xc0, 0x01, 0x00, 0x00, 0x00,   // Offset 0x10-0x16
     // mov rdi, 1          ; fd = stdout
-    0x48, 0xc7, 0xc7, 0x01, 0x00, 0x00, 0x00,   // Offset 0x0E-0x14
+    0x48, 0xc7, 0xc7, 0x01, 0x00, 0x00, 0x00,   // Offset 0x17-0x1D
     // mov rdx, 14         ; length (strlen("Hello Ring 3!\n"))
-    0x48, 0xc7, 0xc2, 0x0e, 0x00, 0x00, 0x00,   // Offset 0x15-0x1B
+    0x48, 0xc7, 0xc2, 0x0e, 0x00, 0x00, 0x00,   // Offset 0x1E-0x24
     // syscall
-    0x0f, 0x05,                                  // Offset 0x1C-0x1D
+    0x0f, 0x05,                                  // Offset 0x25-0x26
 
     // --- sys_exit(0) ---
     // mov rax, 0          ; SYS_EXIT = 0
-    0x48, 0xc7, 0xc0, 0x00, 0x00, 0x00, 0x00,   // Offset 0x1E-0x24
+    0x48, 0xc7, 0xc0, 0x00, 0x00, 0x00, 0x00,   // Offset 0x27-0x2D
     // syscall
-    0x0f, 0x05,                                  // Offset 0x25-0x26
+    0x0f, 0x05,                                  // Offset 0x2E-0x2F
 
     // --- Infinite loop (safety) ---
     // jmp $
-    0xeb, 0xfe,                                  // Offset 0x27-0x28
+    0xeb, 0xfe,                                  // Offset 0x30-0x31
 
-    // --- Message string (at offset 0x29) ---
+    // --- Message string (at offset 0x32) ---
     'H', 'e', 'l', 'l', 'o', ' ', 'R', 'i', 'n', 'g', ' ', '3', '!', '\n', '\0'
 };
 
-// User-Space Adressen (niedrig im virtuellen Adressraum)
-#define USER_CODE_VADDR  0x400000   // 4MB - typische User-Code Adresse
-#define USER_STACK_VADDR 0x800000   // 8MB - User Stack
+// User-Space Adressen (im User-Bereich des eigenen Adressraums)
+#define USER_CODE_VADDR  (VMM_USER_BASE + 0x400000)   // +4MB - User Code
+#define USER_STACK_VADDR (VMM_USER_BASE + 0x800000)   // +8MB - User Stack
+#define USER_STACK_SIZE  (16 * PAGE_SIZE)             // Reserviert, gemappt bei Bedarf
 
 void cmd_usertest(const char* args) {
     (void)args;
 
-    // 1. Pages allozieren
+    // 1. Eigener Adressraum (Kernel-Hälfte geteilt) und Pages allozieren
+    vmm_space_t* space = vmm_space_create();
     uint64_t code_phys = (uint64_t)pmm_alloc_page();
-    uint64_t stack_phys = (uint64_t)pmm_alloc_page();
 
-    if (!code_phys || !stack_phys) {
+    if (!space || !code_phys) {
         vga_println("ERROR: Memory allocation failed!");
+        if (code_phys) pmm_free_page((void*)code_phys);
+        vmm_space_destroy(space);
+        return;
+    }
+
+    // 2. Code mappen mit PAGE_USER! Danach gehört der Frame dem Mapping
+    //    (vmm_space_destroy gibt ihn wieder frei). Der Stack wird nur
+    //    reserviert, seine Pages holt der Page Fault Handler beim ersten Zugriff
+    vmm_map_page(space, USER_CODE_VADDR, code_phys, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+    pmm_free_page((void*)code_phys);
+    if (!vmm_reserve(space, USER_STACK_VADDR, USER_STACK_SIZE, PAGE_WRITE | PAGE_USER)) {
+        vga_println("ERROR: Stack reservation failed!");
+        vmm_space_destroy(space);
         return;
     }
 
-    // 2. Mappen mit PAGE_USER!
-    vmm_map_page(USER_CODE_VADDR, code_phys, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
-    vmm_map_page(USER_STACK_VADDR, stack_phys, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+    // 3. Code über die Direct Map kopieren (space ist noch nicht geladen)
+    memcpy(phys_to_virt(code_phys), user_code, sizeof(user_code));
 
-    // 3. Code kopieren
-    memcpy((void*)USER_CODE_VADDR, user_code, sizeof(user_code));
+    // Der Code ist jetzt nur noch über sein Mapping erreichbar -> kompaktierbar
+    pmm_page_set_movable((void*)code_phys, space->pml4_phys, USER_CODE_VADDR);
 
     // 4. Stacks vorbereiten
-    uint64_t user_stack_top = (USER_STACK_VADDR + PAGE_SIZE) - 16;
+    uint64_t user_stack_top = (USER_STACK_VADDR + USER_STACK_SIZE) - 16;
 
     // Kernel Stack für Syscalls/Interrupts
     static uint8_t secure_kernel_stack[8192] __attribute__((aligned(16)));
@@ -88,9 +111,12 @@ void cmd_usertest(const char* args) {
     tss_set_kernel_stack(k_stack_top);
     syscall_set_kernel_stack(k_stack_top);
 
-    // 5. TLB FLUSH
-    vmm_set_cr3(vmm_get_cr3());
-
-    // 6. Sprung in User Mode
+    // 5. Adressraum laden und in User Mode springen
+    task_t* task = task_get_current();
+    if (task) {
+        task->space = space;
+        task->kernel_stack_top = k_stack_top;  // Auch nach fork() wieder diesen RSP0
+    }
+    vmm_switch_space(space);
     jump_to_usermode(user_stack_top, USER_CODE_VADDR);
 }
@@ -28,11 +28,11 @@ void cmd_vmtest(const char* args) {
     vga_print_hex(virt_addr);
     vga_println("");
 
-    vmm_map_page(virt_addr, (uint64_t)phys_page, PAGE_PRESENT | PAGE_WRITE);
+    vmm_map_page(&vmm_kernel_space, virt_addr, (uint64_t)phys_page, PAGE_PRESENT | PAGE_WRITE);
     vga_println("  Mapping successful!");
 
     // Test 3: Checke ob Mapping funktioniert
-    uint64_t resolved_phys = vmm_virt_to_phys(virt_addr);
+    uint64_t resolved_phys = vmm_virt_to_phys(&vmm_kernel_space, virt_addr);
     vga_print("  Resolved physical address: ");
     vga_print_hex(resolved_phys);
     vga_println("");
@@ -67,9 +67,9 @@ void cmd_vmtest(const char* args) {
     // Test 5: Unmap
     vga_println("");
     vga_println("  Unmapping page...");
-    vmm_unmap_page(virt_addr);
+    vmm_unmap_page(&vmm_kernel_space, virt_addr);
 
-    uint64_t resolved_after_unmap = vmm_virt_to_phys(virt_addr);
+    uint64_t resolved_after_unmap = vmm_virt_to_phys(&vmm_kernel_space, virt_addr);
     if (resolved_after_unmap == 0) {
         vga_print_colored("  [PASS] Unmapping successful!", VGA_LIGHT_GREEN, VGA_BLACK);
         vga_println("");
@@ -0,0 +1,147 @@
+// Copyright (c) 2026 KibaOfficial
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+/*
+ * KiOS - CPU Helper
+ *
+ * Kleine Inline-Wrapper für CPU-Instruktionen, die von mehreren
+ * Subsystemen gebraucht werden (Zeitmessung, Feature-Erkennung, ...).
+ */
+
+#ifndef KIOS_CPU_H
+#define KIOS_CPU_H
+
+#include "types.h"
+
+/*
+ * rdtsc - Liest den Time Stamp Counter
+ *
+ * @return: Anzahl CPU-Zyklen seit Reset (für Latenz-Messungen)
+ */
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/*
+ * cpuid - Führt CPUID für leaf/subleaf aus
+ */
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+/*
+ * cpu_apic_id - Initiale Local APIC ID der aktuellen CPU
+ *
+ * @return: CPUID.01h:EBX[31:24]
+ */
+static inline uint32_t cpu_apic_id(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return ebx >> 24;
+}
+
+/*
+ * cpu_has_1gb_pages - Unterstützt die CPU 1 GB Pages (PDPT Leaf)?
+ *
+ * @return: CPUID.80000001h:EDX[26] (Page1GB)
+ */
+static inline int cpu_has_1gb_pages(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000001) {
+        return 0;
+    }
+    cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+    return (edx >> 26) & 1;
+}
+
+/*
+ * cpu_has_pcid - Unterstützt die CPU Process-Context Identifiers?
+ *
+ * @return: CPUID.01h:ECX[17] (PCID)
+ */
+static inline int cpu_has_pcid(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return (ecx >> 17) & 1;
+}
+
+/*
+ * cpu_has_pat - Unterstützt die CPU die Page Attribute Table?
+ *
+ * @return: CPUID.01h:EDX[16] (PAT)
+ */
+static inline int cpu_has_pat(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return (edx >> 16) & 1;
+}
+
+// Model Specific Registers
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    uint32_t lo = value & 0xFFFFFFFF;
+    uint32_t hi = value >> 32;
+    __asm__ volatile("wrmsr" :: "a"(lo), "d"(hi), "c"(msr));
+}
+
+// CR0 Bits
+#define CPU_CR0_WP     (1ULL << 16)   // Write Protect: R/O Pages gelten auch für Ring 0
+
+static inline uint64_t cpu_read_cr0(void) {
+    uint64_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void cpu_write_cr0(uint64_t cr0) {
+    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0) : "memory");
+}
+
+// CR4 Bits
+#define CPU_CR4_PGE    (1ULL << 7)    // Global Pages
+#define CPU_CR4_PCIDE  (1ULL << 17)   // PCID in CR3[11:0]
+
+static inline uint64_t cpu_read_cr4(void) {
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void cpu_write_cr4(uint64_t cr4) {
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+/*
+ * cpu_irq_save - Interrupts sperren und vorherigen Zustand merken
+ *
+ * @return: RFLAGS vor dem cli (für cpu_irq_restore)
+ */
+static inline uint64_t cpu_irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+/*
+ * cpu_irq_restore - Interrupts nur wieder erlauben, wenn sie vorher an waren
+ */
+static inline void cpu_irq_restore(uint64_t flags) {
+    if (flags & (1 << 9)) {  // RFLAGS.IF
+        __asm__ volatile("sti" ::: "memory");
+    }
+}
+
+#endif /* KIOS_CPU_H */
@@ -99,6 +99,9 @@ void idt_init(void) {
     idt_set_gate(46, (uint64_t)irq14, 0x08, IDT_TYPE_INTERRUPT);
     idt_set_gate(47, (uint64_t)irq15, 0x08, IDT_TYPE_INTERRUPT);
 
+    /* Freiwilliger Task-Wechsel (task_yield) */
+    idt_set_gate(TASK_YIELD_VECTOR, (uint64_t)irq_yield, 0x08, IDT_TYPE_INTERRUPT);
+
     /* IDT laden */
     idt_load((uint64_t)&idtp);
 }
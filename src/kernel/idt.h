@@ -88,6 +88,9 @@ typedef struct {
 #define IRQ14 46    /* Primary ATA */
 #define IRQ15 47    /* Secondary ATA */
 
+/* Freiwilliger Task-Wechsel (task_yield), Gate nur für Ring 0 */
+#define TASK_YIELD_VECTOR 48
+
 /* Funktionen */
 void idt_init(void);
 void idt_set_gate(uint8_t num, uint64_t handler, uint16_t selector, uint8_t flags);
@@ -144,5 +147,6 @@ extern void irq12(void);
 extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
+extern void irq_yield(void);
 
 #endif /* KIOS_IDT_H */
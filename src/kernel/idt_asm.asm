@@ -107,6 +107,17 @@ IRQ 13, 45    ; FPU
 IRQ 14, 46    ; Primary ATA
 IRQ 15, 47    ; Secondary ATA
 
+; =============================================================================
+; Freiwilliger Task-Wechsel (task_yield, Vektor 48, nur aus Ring 0)
+; =============================================================================
+; Läuft wie ein IRQ durch irq_common_stub, damit der Scheduler den
+; Stack-Pointer umbiegen kann. Kein PIC beteiligt, daher kein EOI.
+global irq_yield
+irq_yield:
+    push 0          ; Dummy Error Code
+    push 48         ; TASK_YIELD_VECTOR
+    jmp irq_common_stub
+
 ; =============================================================================
 ; Gemeinsamer ISR-Stub
 ; =============================================================================
@@ -118,7 +129,16 @@ IRQ 15, 47    ; Secondary ATA
 ;   [rsp+32] = RFLAGS (von CPU gepusht)
 ;   [rsp+40] = RSP (von CPU gepusht, falls Privilege-Level wechselt)
 ;   [rsp+48] = SS  (von CPU gepusht, falls Privilege-Level wechselt)
+;
+; GS-Konvention: Im Kernel zeigt GS_BASE immer auf cpu_data. Kommt der
+; Interrupt aus Ring 3 (RPL des gesicherten CS = 3), steht noch die User-GS
+; in GS_BASE - dann swapgs beim Eintritt und vor dem iretq zurück.
 isr_common_stub:
+    test qword [rsp+24], 3
+    jz .kernel_entry
+    swapgs
+.kernel_entry:
+
     ; Register sichern
     push rax
     push rbx
@@ -183,6 +203,12 @@ isr_common_stub:
     ; Error Code und Interrupt-Nummer vom Stack entfernen
     add rsp, 16
 
+    ; Zurück nach Ring 3? Dann User-GS wiederherstellen ([rsp+8] = CS)
+    test qword [rsp+8], 3
+    jz .kernel_return
+    swapgs
+.kernel_return:
+
     ; Interrupt Return
     iretq
 
@@ -190,6 +216,12 @@ isr_common_stub:
 ; Gemeinsamer IRQ-Stub mit Task-Switching Support
 ; =============================================================================
 irq_common_stub:
+    ; swapgs nur aus Ring 3, siehe isr_common_stub
+    test qword [rsp+24], 3
+    jz .kernel_entry
+    swapgs
+.kernel_entry:
+
     ; Register sichern (gleich wie ISR)
     push rax
     push rbx
@@ -259,5 +291,12 @@ irq_common_stub:
     ; Error Code und IRQ-Nummer entfernen
     add rsp, 16
 
+    ; CS des Ziel-Frames entscheidet - nach einem Task-Switch kann das ein
+    ; anderer Ring sein als beim Eintritt
+    test qword [rsp+8], 3
+    jz .kernel_return
+    swapgs
+.kernel_return:
+
     ; Interrupt Return
     iretq
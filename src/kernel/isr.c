@@ -7,6 +7,8 @@
 #include "idt.h"
 #include "vga.h"
 #include "io.h"
+#include "mm/vmm.h"
+#include "task.h"
 
 /* PIC (Programmable Interrupt Controller) Ports */
 #define PIC1_COMMAND    0x20
@@ -63,6 +65,15 @@ static registers_t *new_task_regs = NULL;
  * isr_handler - Gemeinsamer Handler für alle Exceptions
  */
 void isr_handler(registers_t* regs) {
+    /* Page Fault: erst Demand Paging versuchen (CR2 = Fehleradresse) */
+    uint64_t fault_addr = 0;
+    if (regs->int_no == 14) {
+        fault_addr = vmm_get_cr2();
+        if (vmm_handle_fault(fault_addr, regs->err_code)) {
+            return;
+        }
+    }
+
     vga_set_color(VGA_WHITE, VGA_RED);
     vga_println("");
     vga_println("===========================================");
@@ -87,6 +98,12 @@ void isr_handler(registers_t* regs) {
     vga_print_hex(regs->err_code);
     vga_println("");
 
+    if (regs->int_no == 14) {
+        vga_print("  CR2:     0x");
+        vga_print_hex(fault_addr);
+        vga_println("");
+    }
+
     vga_print("  RIP:     0x");
     vga_print_hex(regs->rip);
     vga_println("");
@@ -139,6 +156,11 @@ void isr_handler(registers_t* regs) {
  * Der Scheduler kann den Stack-Pointer ändern für Task-Switching.
  */
 registers_t* irq_handler(registers_t* regs) {
+    /* Freiwilliger Task-Wechsel: kein PIC beteiligt, also auch kein EOI */
+    if (regs->int_no == TASK_YIELD_VECTOR) {
+        return task_switch(regs);
+    }
+
     /* IRQ-Nummer berechnen (32-47 -> 0-15) */
     int irq = regs->int_no - 32;
 
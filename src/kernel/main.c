@@ -25,7 +25,9 @@
 #include "mm/pmm.h"
 #include "mm/vmm.h"
 #include "mm/heap.h"
+#include "mm/vmalloc.h"
 #include "syscall.h"
+#include "acpi.h"
 
 
 
@@ -75,15 +77,27 @@ void kernel_main(void)
     /* IDT initialisieren (setzt isr8 mit ist=1) */
     idt_init();
 
+    /* ACPI Tabellen suchen (SRAT: NUMA-Knoten für den PMM) */
+    acpi_init();
+
     /* PMM Initialisieren */
     pmm_init();
 
-    /* VMM Initialisieren */
+    /* Frühes ACPI-Fenster abbauen, danach liest ACPI über die Direct Map */
+    acpi_early_done();
+
+    /* VMM Initialisieren (baut die Direct Map auf) */
     vmm_init();
 
+    /* RAM oberhalb 1 GB ist erst jetzt erreichbar */
+    pmm_online_high_memory();
+
     /* Heap Initialisieren */
     heap_init();
 
+    /* vmalloc-Fenster anlegen (braucht kmalloc) */
+    vmalloc_init();
+
     /* Syscall Interface initialisieren (syscall/sysret MSRs) */
     syscall_init();
 
@@ -139,9 +153,16 @@ void kernel_main(void)
     pic_clear_mask(0);
 
     /* Idle Loop - der Scheduler wird nun alle 100ms zu anderen Tasks switchen */
-    /* Wenn kein Task bereit ist, bleibt der Kernel hier im HLT */
+    /* Wenn kein Task bereit ist, landet der Scheduler hier: freie Zeit nutzen */
+    /* um den Pool genullter Pages aufzufüllen, Speicher zu kompaktieren und */
+    /* bei Speichermangel leere Heap-Slabs zurückzugeben, */
+    /* danach im HLT schlafen */
     for (;;)
     {
+        pmm_zero_pool_refill();
+        pmm_compact_idle();
+        heap_reclaim_idle();
+        task_reap();
         __asm__ volatile("hlt");
     }
 }
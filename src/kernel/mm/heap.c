@@ -6,10 +6,129 @@
 #include "heap.h"
 #include "pmm.h"
 #include "vmm.h"
+#include "vmalloc.h"
+#include "vga.h"
+#include "cpu.h"
+#include "syscall.h"
+
+/*
+ * Slab allocator
+ *
+ * The heap window is carved into SLAB_SIZE slabs. Each slab belongs to one
+ * kmem_cache and starts with a slab_t header, so a free finds the slab by
+ * masking the pointer. Freed objects form a per-slab free list; objects that
+ * were never handed out are taken from a bump offset instead, so a new slab
+ * only touches (and faults in) the pages it actually uses.
+ *
+ * Slabs with free objects sit on their cache's partial list. Each cache
+ * keeps one empty slab as a spare; further empty slabs go to a shared list
+ * and can be reused by any cache. kmalloc() is a set of caches, one per
+ * size class, with per-CPU magazines in front (see below).
+ *
+ * The heap VMA starts with HEAP_SIZE and grows in HEAP_GROW_SIZE steps up
+ * to HEAP_MAX_SIZE. When free memory runs low, heap_shrink() unmaps empty
+ * slabs and returns their frames to the PMM; released slots are marked in
+ * a bitmap and reused before the window grows any further.
+ */
+#define SLAB_SIZE        (16 * 1024)
+#define SLAB_MAGIC       0x51AB51ABU
+#define SLAB_HEADER_SIZE ((sizeof(slab_t) + 15) & ~(uint64_t)15)
+#define HEAP_MAX_SLABS   (HEAP_MAX_SIZE / SLAB_SIZE)
+
+typedef struct slab {
+    uint32_t magic;
+    uint16_t inuse;           // Objects currently handed out
+    uint16_t total;           // Objects that fit into the slab
+    kmem_cache_t* cache;      // Owning cache
+    void* free;               // Free list of returned objects
+    uint64_t objs;            // First object (after header and colour)
+    uint64_t bump;            // Next never-used object
+    struct slab* next;        // Partial list / empty list
+    struct slab* prev;
+} slab_t;
+
+// Power-of-two classes plus intermediate steps; all multiples of 16 bytes
+static const uint32_t size_classes[HEAP_SIZE_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+static const char* const size_class_names[HEAP_SIZE_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64", "kmalloc-96",
+    "kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-384", "kmalloc-512",
+    "kmalloc-768", "kmalloc-1k", "kmalloc-1.5k", "kmalloc-2k", "kmalloc-3k", "kmalloc-4k"
+};
+#define SIZE_CLASS_COUNT HEAP_SIZE_CLASSES
+
+// Size (in 16 byte steps) -> class index, filled by heap_init
+static uint8_t class_index[PAGE_SIZE / 16];
+
+static kmem_cache_t kmalloc_caches[SIZE_CLASS_COUNT];
+static kmem_cache_t cache_cache;          // kmem_cache_t objects themselves
+static kmem_cache_t magazine_cache;       // heap_magazine_t for the kmalloc magazines
+static kmem_cache_t* cache_list = NULL;
+
+static slab_t* empty_slabs = NULL;
 
 // Heap State
-static uint64_t heap_current_ptr = HEAP_START;
+static uint64_t heap_current_ptr = HEAP_START;   // End of the carved slabs
 static uint64_t heap_total_alloc = 0;
+static uint64_t slab_count = 0;          // Carved slabs that are not released
+static uint64_t empty_slab_count = 0;
+
+// Slab slots whose pages were returned to the PMM
+static uint64_t released_map[HEAP_MAX_SLABS / 64];
+static uint64_t released_count = 0;
+static uint64_t released_hint = 0;       // No released slot in words below
+static uint64_t reclaimed_pages = 0;
+static uint64_t shrink_idle_free_pages = 0;   // Free pages after the last idle shrink
+
+// The whole heap window is reserved up front; pages are faulted in on first touch
+static vmm_vma_t heap_vma;
+
+static uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Offset of the first object in a slab, before colouring
+static uint32_t slab_first_offset(const kmem_cache_t* cache) {
+    return align_up(SLAB_HEADER_SIZE, cache->align);
+}
+
+/*
+ * Set up cache geometry. With a constructor the free list link is stored
+ * behind the object so that freeing never clobbers constructed state.
+ */
+static void cache_setup(kmem_cache_t* cache, const char* name, uint32_t size,
+                        uint32_t align, void (*ctor)(void*)) {
+    if (align < 16) {
+        align = 16;
+    }
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+    if (ctor) {
+        cache->free_offset = align_up(size, sizeof(void*));
+        cache->size = align_up(cache->free_offset + sizeof(void*), align);
+    } else {
+        cache->free_offset = 0;
+        cache->size = align_up(size < sizeof(void*) ? sizeof(void*) : size, align);
+    }
+
+    uint32_t first = slab_first_offset(cache);
+    uint32_t total = (SLAB_SIZE - first) / cache->size;
+    cache->colour = 0;
+    cache->colour_range = SLAB_SIZE - first - total * cache->size;
+    cache->partial = NULL;
+    cache->spare = NULL;
+    cache->active = 0;
+    cache->slabs = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    cache->next = cache_list;
+    cache_list = cache;
+}
 
 /**
  * heap_init - Initialize kernel heap
@@ -17,84 +136,763 @@ static uint64_t heap_total_alloc = 0;
 void heap_init(void) {
     heap_current_ptr = HEAP_START;
     heap_total_alloc = 0;
+
+    uint32_t cls = 0;
+    for (uint32_t i = 0; i < PAGE_SIZE / 16; i++) {
+        while ((i + 1) * 16 > size_classes[cls]) {
+            cls++;
+        }
+        class_index[i] = (uint8_t)cls;
+    }
+
+    // Listed in reverse, so the kmalloc caches show up smallest first
+    cache_setup(&magazine_cache, "heap_magazine", sizeof(heap_magazine_t), 0, NULL);
+    cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, NULL);
+    for (uint32_t i = SIZE_CLASS_COUNT; i-- > 0;) {
+        cache_setup(&kmalloc_caches[i], size_class_names[i], size_classes[i], 0, NULL);
+    }
+
+    // kmalloc() cannot allocate its own VMA, so it lives here
+    heap_vma.start = HEAP_START;
+    heap_vma.end = HEAP_START + HEAP_SIZE;   // Grows with the heap, see heap_grow
+    heap_vma.flags = PAGE_PRESENT | PAGE_WRITE;
+    heap_vma.movable = 1;   // The heap is only accessed virtually, so its frames may migrate
+    vmm_vma_insert(&vmm_kernel_space, &heap_vma);
 }
 
-/**
- * kmalloc - Allocate memory from kernel heap
- * @size: Number of bytes to allocate
- *
- * Simple bump allocator. Memory is never freed (kfree is a no-op).
- * Pages are mapped on-demand as the heap grows.
+static void slab_list_remove(slab_t** list, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+static void slab_list_push(slab_t** list, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static uint64_t slab_index(uint64_t addr) {
+    return (addr - HEAP_START) / SLAB_SIZE;
+}
+
+static int slab_released(uint64_t index) {
+    return (released_map[index / 64] >> (index % 64)) & 1;
+}
+
+// Lowest released slot, its pages are faulted in again on first touch
+static slab_t* slab_take_released(void) {
+    for (uint64_t w = released_hint; w < HEAP_MAX_SLABS / 64; w++) {
+        if (released_map[w]) {
+            uint64_t index = w * 64 + (uint64_t)__builtin_ctzll(released_map[w]);
+            released_map[w] &= released_map[w] - 1;
+            released_hint = w;
+            released_count--;
+            return (slab_t*)(HEAP_START + index * SLAB_SIZE);
+        }
+    }
+    return NULL;
+}
+
+// Extend the heap VMA by HEAP_GROW_SIZE, 0 = reservation used up
+static int heap_grow(void) {
+    uint64_t end = heap_vma.end + HEAP_GROW_SIZE;
+    if (end > HEAP_START + HEAP_MAX_SIZE || (heap_vma.next && heap_vma.next->start < end)) {
+        return 0;
+    }
+    heap_vma.end = end;
+    return 1;
+}
+
+static uint64_t heap_unmap_span(uint64_t start, uint64_t size);
+static uint64_t heap_release_empty(void);
+
+// Slab slot for slab_create: an empty slab, a released slot or a new one from the window
+static slab_t* slab_take(void) {
+    slab_t* slab = empty_slabs;
+    if (slab) {
+        slab_list_remove(&empty_slabs, slab);
+        empty_slab_count--;
+    } else if (released_count) {
+        slab = slab_take_released();
+        slab_count++;
+    } else {
+        if (heap_current_ptr + SLAB_SIZE > heap_vma.end && !heap_grow()) {
+            return NULL;
+        }
+        slab = (slab_t*)heap_current_ptr;
+        heap_current_ptr += SLAB_SIZE;
+        slab_count++;
+    }
+    return slab;
+}
+
+// Undo slab_take after a failed populate: drop what got mapped, release the slot
+static void slab_untake(slab_t* slab) {
+    reclaimed_pages += heap_unmap_span((uint64_t)slab, SLAB_SIZE);
+    slab_count--;
+
+    if ((uint64_t)slab + SLAB_SIZE == heap_current_ptr) {
+        heap_current_ptr -= SLAB_SIZE;
+        return;
+    }
+    uint64_t index = slab_index((uint64_t)slab);
+    released_map[index / 64] |= 1ULL << (index % 64);
+    released_count++;
+    if (index / 64 < released_hint) {
+        released_hint = index / 64;
+    }
+}
+
+/*
+ * Get a slab for cache: reuse an empty one, a released slot or carve a new
+ * one from the heap window. Consecutive slabs start their objects at different cache-line
+ * offsets (colouring), so equal objects of different slabs do not all
+ * compete for the same cache sets.
  *
- * Returns: Pointer to allocated memory, or NULL on failure
+ * The page holding the header is populated before it is written - a fault
+ * on it without a free frame could not be handled. The object pages are
+ * still left to the page fault handler. If populating fails, the empty
+ * slabs are released and the slab is tried once more. Returns NULL when the
+ * window or physical memory is exhausted.
  */
-void* kmalloc(size_t size) {
-    if (size == 0) {
+static slab_t* slab_create(kmem_cache_t* cache) {
+    slab_t* slab = slab_take();
+    if (slab && !vmm_populate(&vmm_kernel_space, (uint64_t)slab, PAGE_SIZE)) {
+        slab_untake(slab);
+        slab = NULL;
+        if (heap_release_empty() && (slab = slab_take()) &&
+            !vmm_populate(&vmm_kernel_space, (uint64_t)slab, PAGE_SIZE)) {
+            slab_untake(slab);
+            slab = NULL;
+        }
+    }
+    if (!slab) {
+        return NULL;
+    }
+
+    uint32_t step = cache->align > KMEM_CACHE_LINE ? cache->align : KMEM_CACHE_LINE;
+    uint32_t colour = cache->colour;
+    cache->colour = colour + step <= cache->colour_range ? colour + step : 0;
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->total = (uint16_t)((SLAB_SIZE - slab_first_offset(cache)) / cache->size);
+    slab->free = NULL;
+    slab->objs = (uint64_t)slab + slab_first_offset(cache) + colour;
+    slab->bump = slab->objs;
+    slab_list_push(&cache->partial, slab);
+    cache->slabs++;
+    return slab;
+}
+
+// Hand a slab without objects back to the shared empty list
+static void slab_release(kmem_cache_t* cache, slab_t* slab) {
+    slab_list_remove(&cache->partial, slab);
+    cache->slabs--;
+    slab->magic = 0;
+    slab_list_push(&empty_slabs, slab);
+    empty_slab_count++;
+}
+
+static void** free_link(kmem_cache_t* cache, void* obj) {
+    return (void**)((uint8_t*)obj + cache->free_offset);
+}
+
+static void* slab_alloc(kmem_cache_t* cache) {
+    slab_t* slab = cache->partial;
+    if (!slab && !(slab = slab_create(cache))) {
         return NULL;
     }
+    if (slab == cache->spare) {
+        cache->spare = NULL;
+    }
+
+    void* obj = slab->free;
+    if (obj) {
+        slab->free = *free_link(cache, obj);
+        cache->hits++;
+    } else {
+        obj = (void*)slab->bump;
+        slab->bump += cache->size;
+        cache->misses++;
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+    }
+
+    // Full slabs are not on any list until an object comes back
+    if (++slab->inuse == slab->total) {
+        slab_list_remove(&cache->partial, slab);
+    }
+    cache->active++;
+    heap_total_alloc += cache->size;
+    return obj;
+}
+
+static void slab_free(slab_t* slab, void* ptr) {
+    kmem_cache_t* cache = slab->cache;
+
+    *free_link(cache, ptr) = slab->free;
+    slab->free = ptr;
+    if (slab->inuse-- == slab->total) {
+        slab_list_push(&cache->partial, slab);
+    }
+    cache->active--;
+    heap_total_alloc -= cache->size;
+
+    if (slab->inuse == 0) {
+        if (cache->spare) {
+            slab_release(cache, slab);
+        } else {
+            cache->spare = slab;
+        }
+    }
+}
 
-    // Align size to 16 bytes for better performance
-    size = (size + 15) & ~15;
+/*
+ * Find the slab of a heap pointer and check that ptr is an object start.
+ * Returns NULL for anything that kmalloc/kmem_cache_alloc did not hand out.
+ */
+static slab_t* slab_of(void* ptr) {
+    uint64_t addr = (uint64_t)ptr;
+    if (addr < HEAP_START || addr >= heap_current_ptr || slab_released(slab_index(addr))) {
+        return NULL;
+    }
 
-    // Check if we exceed heap limit
-    if (heap_current_ptr + size >= HEAP_START + HEAP_SIZE) {
+    slab_t* slab = (slab_t*)(addr & ~(uint64_t)(SLAB_SIZE - 1));
+    if (slab->magic != SLAB_MAGIC || addr < slab->objs ||
+        (addr - slab->objs) % slab->cache->size != 0) {
         return NULL;
     }
+    return slab;
+}
+
+/**
+ * kmem_cache_create - Create an object cache
+ * @name: Name shown by slabinfo (must stay valid)
+ * @size: Object size in bytes (at most PAGE_SIZE)
+ * @align: Object alignment, power of two up to PAGE_SIZE (0 = 16 bytes)
+ * @ctor: Called once per object when it is first carved, or NULL
+ *
+ * Returns: New cache, or NULL on invalid arguments / no memory
+ */
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align,
+                                void (*ctor)(void* obj)) {
+    if (size == 0 || size > PAGE_SIZE || align > PAGE_SIZE || (align & (align - 1))) {
+        return NULL;
+    }
+
+    uint64_t flags = cpu_irq_save();
+    kmem_cache_t* cache = (kmem_cache_t*)slab_alloc(&cache_cache);
+    if (cache) {
+        cache_setup(cache, name, size, align, ctor);
+    }
+    cpu_irq_restore(flags);
+    return cache;
+}
+
+/**
+ * kmem_cache_alloc - Allocate an object from a cache
+ *
+ * Returns: Object in constructed state, or NULL when the heap is exhausted
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    uint64_t flags = cpu_irq_save();
+    void* obj = slab_alloc(cache);
+    cpu_irq_restore(flags);
+    return obj;
+}
+
+/**
+ * kmem_cache_free - Return an object (in constructed state) to its cache
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    if (!obj) {
+        return;
+    }
+
+    uint64_t flags = cpu_irq_save();
+    slab_t* slab = slab_of(obj);
+    if (!slab || slab->cache != cache) {
+        cpu_irq_restore(flags);
+        vga_println("[HEAP] ERROR: kmem_cache_free of foreign object!");
+        return;
+    }
+    slab_free(slab, obj);
+    cpu_irq_restore(flags);
+}
+
+/**
+ * kmem_cache_destroy - Remove a cache whose objects have all been freed
+ */
+void kmem_cache_destroy(kmem_cache_t* cache) {
+    uint64_t flags = cpu_irq_save();
+    slab_t* own = slab_of(cache);
+    if (cache->active || !own || own->cache != &cache_cache) {
+        cpu_irq_restore(flags);
+        vga_println("[HEAP] ERROR: kmem_cache_destroy of busy or static cache!");
+        return;
+    }
+
+    // Without live objects only the spare slab is left
+    if (cache->spare) {
+        slab_release(cache, cache->spare);
+        cache->spare = NULL;
+    }
+
+    kmem_cache_t** link = &cache_list;
+    while (*link != cache) {
+        link = &(*link)->next;
+    }
+    *link = cache->next;
+    slab_free(own, cache);
+    cpu_irq_restore(flags);
+}
+
+/**
+ * kmem_cache_list - First cache, the rest follows via ->next
+ */
+kmem_cache_t* kmem_cache_list(void) {
+    return cache_list;
+}
+
+/*
+ * Magazine layer
+ *
+ * The fast paths in kmalloc/kfree only touch the current CPU's loaded
+ * magazine with interrupts disabled. When it runs empty (full), the
+ * previous magazine is swapped in if it is full (empty); only then a whole
+ * magazine is exchanged with the depot, and only if the depot cannot help
+ * the object goes to the slab layer. The depot and the slab layer are the
+ * shared state - on SMP they are what needs the lock, the fast path does
+ * not.
+ */
+typedef struct {
+    heap_magazine_t* full;
+    heap_magazine_t* empty;
+    uint64_t full_count;
+} heap_depot_t;
+
+static heap_depot_t depot[SIZE_CLASS_COUNT];
+
+static void mag_push(heap_magazine_t** list, heap_magazine_t* mag) {
+    mag->next = *list;
+    *list = mag;
+}
+
+static heap_magazine_t* mag_pop(heap_magazine_t** list) {
+    heap_magazine_t* mag = *list;
+    if (mag) {
+        *list = mag->next;
+    }
+    return mag;
+}
+
+// Give all objects of a magazine back to their slabs
+static void mag_flush(heap_magazine_t* mag) {
+    while (mag->count) {
+        void* obj = mag->objs[--mag->count];
+        slab_free(slab_of(obj), obj);
+    }
+}
+
+static void* mag_alloc_slow(heap_cpu_cache_t* cc, uint32_t cls) {
+    heap_magazine_t* prev = cc->previous[cls];
+    cc->misses++;
+
+    if (prev && prev->count) {
+        cc->previous[cls] = cc->loaded[cls];
+        cc->loaded[cls] = prev;
+        return prev->objs[--prev->count];
+    }
+
+    // Exchange the empty previous magazine for a full one from the depot
+    heap_magazine_t* full = mag_pop(&depot[cls].full);
+    if (full) {
+        depot[cls].full_count--;
+        if (prev) {
+            mag_push(&depot[cls].empty, prev);
+        }
+        cc->previous[cls] = cc->loaded[cls];
+        cc->loaded[cls] = full;
+        return full->objs[--full->count];
+    }
 
-    // Calculate which pages we need
-    uint64_t start_addr = heap_current_ptr;
-    uint64_t end_addr = heap_current_ptr + size;
+    return slab_alloc(&kmalloc_caches[cls]);
+}
 
-    uint64_t start_page = start_addr & ~0xFFF;  // Align down to page boundary
-    uint64_t end_page = (end_addr + 0xFFF) & ~0xFFF;  // Align up to page boundary
+static void mag_free_slow(heap_cpu_cache_t* cc, uint32_t cls, slab_t* slab, void* ptr) {
+    heap_magazine_t* prev = cc->previous[cls];
+    heap_magazine_t* empty;
+    cc->misses++;
 
-    // Map all required pages
-    for (uint64_t page = start_page; page < end_page; page += 0x1000) {
-        // Check if page is already mapped
-        if (vmm_virt_to_phys(page) == 0) {
-            // Not mapped, allocate physical page
-            void* phys_page = pmm_alloc_page();
-            if (!phys_page) {
-                return NULL;
+    if (prev && !prev->count) {
+        empty = prev;
+    } else {
+        // Hand the full previous magazine to the depot; if it already holds
+        // enough, the objects go back to their slabs instead
+        if (prev && depot[cls].full_count >= HEAP_DEPOT_MAX) {
+            mag_flush(prev);
+            empty = prev;
+        } else {
+            empty = mag_pop(&depot[cls].empty);
+            if (!empty) {
+                empty = (heap_magazine_t*)slab_alloc(&magazine_cache);
+                if (!empty) {
+                    slab_free(slab, ptr);
+                    return;
+                }
+                empty->count = 0;
+            }
+            if (prev) {
+                mag_push(&depot[cls].full, prev);
+                depot[cls].full_count++;
             }
+        }
+    }
 
-            // Map to virtual address
-            vmm_map_page(page, (uint64_t)phys_page, PAGE_PRESENT | PAGE_WRITE);
+    cc->previous[cls] = cc->loaded[cls];
+    cc->loaded[cls] = empty;
+    empty->objs[empty->count++] = ptr;
+}
+
+// Objects sitting in magazines count as free for heap_total_allocated()
+static uint64_t mag_cached_bytes(void) {
+    heap_cpu_cache_t* cc = &cpu_current()->heap_cache;
+    uint64_t bytes = 0;
+    for (uint32_t cls = 0; cls < SIZE_CLASS_COUNT; cls++) {
+        uint64_t objs = 0;
+        if (cc->loaded[cls]) {
+            objs += cc->loaded[cls]->count;
+        }
+        if (cc->previous[cls]) {
+            objs += cc->previous[cls]->count;
+        }
+        for (heap_magazine_t* mag = depot[cls].full; mag; mag = mag->next) {
+            objs += mag->count;
         }
+        bytes += objs * kmalloc_caches[cls].size;
     }
+    return bytes;
+}
+
+/**
+ * heap_drain_magazines - Return magazine contents and the depot to the slabs
+ *
+ * Afterwards every free kmalloc object is back on its slab, so empty slabs
+ * show up as such.
+ */
+void heap_drain_magazines(void) {
+    uint64_t flags = cpu_irq_save();
+    heap_cpu_cache_t* cc = &cpu_current()->heap_cache;
+    for (uint32_t cls = 0; cls < SIZE_CLASS_COUNT; cls++) {
+        heap_magazine_t* mags[2] = { cc->loaded[cls], cc->previous[cls] };
+        cc->loaded[cls] = NULL;
+        cc->previous[cls] = NULL;
+        for (uint32_t i = 0; i < 2; i++) {
+            if (mags[i]) {
+                mag_flush(mags[i]);
+                slab_free(slab_of(mags[i]), mags[i]);
+            }
+        }
 
-    // Return pointer and advance heap pointer
-    void* ptr = (void*)heap_current_ptr;
-    heap_current_ptr += size;
-    heap_total_alloc += size;
+        heap_magazine_t* mag;
+        while ((mag = mag_pop(&depot[cls].full))) {
+            mag_flush(mag);
+            slab_free(slab_of(mag), mag);
+        }
+        while ((mag = mag_pop(&depot[cls].empty))) {
+            slab_free(slab_of(mag), mag);
+        }
+        depot[cls].full_count = 0;
+    }
+    cpu_irq_restore(flags);
+}
 
-    return ptr;
+// Drop the frames of [start, start+size) and unmap it in one go; returns pages freed
+static uint64_t heap_unmap_span(uint64_t start, uint64_t size) {
+    uint64_t pages = 0;
+    for (uint64_t virt = start; virt < start + size; virt += PAGE_SIZE) {
+        uint64_t phys = vmm_virt_to_phys(&vmm_kernel_space, virt);
+        if (phys) {
+            // Heap frames are movable and keep their allocation reference
+            pmm_free_page((void*)phys);
+            pages++;
+        }
+    }
+    if (pages) {
+        vmm_unmap_range(&vmm_kernel_space, start, size);
+    }
+    return pages;
 }
 
 /**
- * kfree - Free allocated memory (NO-OP for bump allocator)
- * @ptr: Pointer to memory to free
+ * heap_shrink - Return the pages of all empty slabs to the PMM
  *
- * This is a dummy function for the bump allocator.
- * Memory is never actually freed until the system reboots.
+ * Drains the magazines and the caches' spare slabs first, so every slab
+ * without live objects is released. Adjacent released slots are unmapped
+ * as one span (one TLB flush), released slots at the top give the window
+ * back.
  *
- * Note: A proper allocator with free-list will be implemented in v0.5.0+
+ * Returns: Number of pages freed
+ */
+uint64_t heap_shrink(void) {
+    heap_drain_magazines();
+    return heap_release_empty();
+}
+
+/*
+ * Release the spare and empty slabs without touching the magazines: the
+ * magazine slow paths allocate slabs while they hold a magazine, so
+ * slab_create may not drain them underneath.
+ */
+static uint64_t heap_release_empty(void) {
+    uint64_t flags = cpu_irq_save();
+    for (kmem_cache_t* cache = cache_list; cache; cache = cache->next) {
+        if (cache->spare) {
+            slab_release(cache, cache->spare);
+            cache->spare = NULL;
+        }
+    }
+
+    // Only spans around newly released slots still have pages mapped
+    uint64_t first = HEAP_MAX_SLABS;
+    uint64_t last = 0;
+    slab_t* slab;
+    while ((slab = empty_slabs)) {
+        slab_list_remove(&empty_slabs, slab);
+        empty_slab_count--;
+        slab_count--;
+
+        uint64_t index = slab_index((uint64_t)slab);
+        released_map[index / 64] |= 1ULL << (index % 64);
+        released_count++;
+        if (index / 64 < released_hint) {
+            released_hint = index / 64;
+        }
+        first = index < first ? index : first;
+        last = index > last ? index : last;
+    }
+
+    uint64_t pages = 0;
+    for (uint64_t i = first; i <= last && i < HEAP_MAX_SLABS;) {
+        if (!slab_released(i)) {
+            i++;
+            continue;
+        }
+        uint64_t j = i;
+        while (j <= last && slab_released(j)) {
+            j++;
+        }
+        pages += heap_unmap_span(HEAP_START + i * SLAB_SIZE, (j - i) * SLAB_SIZE);
+        i = j;
+    }
+
+    while (heap_current_ptr > HEAP_START && slab_released(slab_index(heap_current_ptr) - 1)) {
+        uint64_t index = slab_index(heap_current_ptr) - 1;
+        released_map[index / 64] &= ~(1ULL << (index % 64));
+        released_count--;
+        heap_current_ptr -= SLAB_SIZE;
+    }
+
+    reclaimed_pages += pages;
+    cpu_irq_restore(flags);
+    return pages;
+}
+
+/**
+ * heap_reclaim_idle - Shrink the heap while free memory is below the watermark
+ */
+void heap_reclaim_idle(void) {
+    uint64_t total = pmm_total_pages();
+    uint64_t free = total - pmm_used_pages();
+    if (free >= total / HEAP_RECLAIM_DIVISOR || free == shrink_idle_free_pages) {
+        return;
+    }
+
+    // Nothing to gain: only try again once the amount of free memory changes
+    heap_shrink();
+    shrink_idle_free_pages = total - pmm_used_pages();
+}
+
+/*
+ * Allocations above a page go straight to the buddy allocator and are used
+ * through the direct map; beyond the largest buddy block they fall back to
+ * vmalloc.
+ */
+static void* kmalloc_large(size_t size) {
+    uint32_t order = 0;
+    while (((uint64_t)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    if (order > PMM_MAX_ORDER) {
+        return vmalloc(size);
+    }
+
+    void* block = pmm_alloc_pages(order);
+    if (!block && heap_shrink()) {
+        block = pmm_alloc_pages(order);
+    }
+    if (!block) {
+        return NULL;
+    }
+
+    uint64_t flags = cpu_irq_save();
+    heap_total_alloc += (uint64_t)PAGE_SIZE << order;
+    cpu_irq_restore(flags);
+    return phys_to_virt((uint64_t)block);
+}
+
+/**
+ * kmalloc - Allocate memory from kernel heap
+ * @size: Number of bytes to allocate
+ *
+ * Sizes up to a page are served from the current CPU's magazine for the
+ * smallest fitting size class (refilled from the depot or the slabs),
+ * larger ones from the page allocator. All pointers are at least 16-byte
+ * aligned. Slab pages are mapped by the page fault handler on first touch.
+ *
+ * Returns: Pointer to allocated memory, or NULL on failure
+ */
+void* kmalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    if (size > PAGE_SIZE) {
+        return kmalloc_large(size);
+    }
+
+    uint32_t cls = class_index[(size - 1) / 16];
+    uint64_t flags = cpu_irq_save();
+    heap_cpu_cache_t* cc = &cpu_current()->heap_cache;
+    heap_magazine_t* mag = cc->loaded[cls];
+    void* obj;
+    if (mag && mag->count) {
+        obj = mag->objs[--mag->count];
+        cc->hits++;
+    } else {
+        obj = mag_alloc_slow(cc, cls);
+    }
+    cpu_irq_restore(flags);
+    return obj;
+}
+
+/**
+ * kfree - Free allocated memory
+ * @ptr: Pointer returned by kmalloc (NULL is ignored)
+ *
+ * Heap pointers go back to their slab, direct-map pointers to the page
+ * allocator and vmalloc pointers to vfree().
  */
 void kfree(void* ptr) {
-    // NO-OP for bump allocator
-    (void)ptr;
+    uint64_t addr = (uint64_t)ptr;
+    if (!ptr) {
+        return;
+    }
+
+    if (addr >= VMALLOC_START && addr < VMALLOC_END) {
+        vfree(ptr);
+        return;
+    }
+
+    uint64_t flags = cpu_irq_save();
+    if (addr >= VMM_DIRECT_MAP_BASE && addr < VMALLOC_START) {
+        page_t* page = pmm_phys_to_page(virt_to_phys(ptr));
+        if (page && page->refcount) {
+            heap_total_alloc -= (uint64_t)PAGE_SIZE << page->order;
+            pmm_free_pages((void*)virt_to_phys(ptr), page->order);
+        }
+        cpu_irq_restore(flags);
+        return;
+    }
+
+    slab_t* slab = slab_of(ptr);
+    if (!slab) {
+        cpu_irq_restore(flags);
+        vga_println("[HEAP] ERROR: kfree of invalid pointer!");
+        return;
+    }
+
+    // Objects of other caches (kmem_cache_alloc) bypass the magazines
+    uint64_t cls = ((uint64_t)slab->cache - (uint64_t)kmalloc_caches) / sizeof(kmem_cache_t);
+    if (cls >= SIZE_CLASS_COUNT) {
+        slab_free(slab, ptr);
+        cpu_irq_restore(flags);
+        return;
+    }
+
+    heap_cpu_cache_t* cc = &cpu_current()->heap_cache;
+    heap_magazine_t* mag = cc->loaded[cls];
+    if (mag && mag->count < HEAP_MAG_SIZE) {
+        mag->objs[mag->count++] = ptr;
+        cc->hits++;
+    } else {
+        mag_free_slow(cc, (uint32_t)cls, slab, ptr);
+    }
+    cpu_irq_restore(flags);
 }
 
 /**
- * heap_total_allocated - Get total bytes allocated
+ * heap_total_allocated - Get bytes currently handed out (rounded to object sizes)
  */
 uint64_t heap_total_allocated(void) {
-    return heap_total_alloc;
+    uint64_t flags = cpu_irq_save();
+    uint64_t bytes = heap_total_alloc - mag_cached_bytes();
+    cpu_irq_restore(flags);
+    return bytes;
 }
 
 /**
- * heap_current_size - Get current heap size
+ * heap_current_size - Get size of the heap window carved into slabs so far
+ * (including released slots below the top)
  */
 uint64_t heap_current_size(void) {
     return heap_current_ptr - HEAP_START;
 }
+
+/**
+ * heap_slabs - Get number of slabs carved / currently empty
+ */
+uint64_t heap_slabs(void) {
+    return slab_count;
+}
+
+uint64_t heap_empty_slabs(void) {
+    return empty_slab_count;
+}
+
+/**
+ * heap_released_slabs - Get number of slab slots whose pages went back to the PMM
+ */
+uint64_t heap_released_slabs(void) {
+    return released_count;
+}
+
+uint64_t heap_reclaimed_pages(void) {
+    return reclaimed_pages;
+}
+
+uint64_t heap_window_size(void) {
+    return heap_vma.end - HEAP_START;
+}
+
+/**
+ * heap_magazine_hits - kmalloc/kfree calls served by the CPU's magazines / not
+ */
+uint64_t heap_magazine_hits(void) {
+    return cpu_current()->heap_cache.hits;
+}
+
+uint64_t heap_magazine_misses(void) {
+    return cpu_current()->heap_cache.misses;
+}
@@ -11,14 +11,96 @@
 // Kernel Heap Base Address (höhere Hälfte, virtuell)
 #define HEAP_START 0xFFFF800000000000ULL
 #define HEAP_SIZE  (16 * 1024 * 1024)  // 16MB initial heap size
+#define HEAP_GROW_SIZE (16 * 1024 * 1024)            // Wachstum des Heap-Fensters pro Schritt
+#define HEAP_MAX_SIZE  (1024ULL * 1024 * 1024)       // Reservierter Bereich (1 GB)
+#define HEAP_RECLAIM_DIVISOR 32   // Unter 1/32 freier Pages gibt der Heap leere Slabs ab
 
-// Heap Allocator Functions
+/*
+ * Object Cache (kmem_cache)
+ *
+ * Ein Cache verwaltet Objekte einer festen Größe in eigenen Slabs. Der
+ * optionale Konstruktor läuft nur, wenn ein Objekt zum ersten Mal aus einem
+ * Slab geschnitten wird - kmem_cache_free() muss es im konstruierten Zustand
+ * zurückgeben, der nächste kmem_cache_alloc() bekommt es unverändert wieder
+ * (Hit). Der Konstruktor läuft mit gesperrten Interrupts.
+ */
+#define KMEM_CACHE_LINE 64   // Schritt für das Cache Colouring der Slabs
+
+typedef struct kmem_cache {
+    const char* name;
+    uint32_t object_size;         // Angefragte Größe
+    uint32_t size;                // Abstand der Objekte im Slab
+    uint32_t align;
+    uint32_t free_offset;         // Position des Free-List Links im Objekt
+    void (*ctor)(void* obj);
+    uint32_t colour;              // Offset des ersten Objekts im nächsten Slab
+    uint32_t colour_range;        // Freier Rest im Slab, über den rotiert wird
+    struct slab* partial;         // Slabs mit freien Objekten
+    struct slab* spare;           // Ein leerer Slab bleibt beim Cache
+    uint64_t active;              // Ausgegebene Objekte
+    uint64_t slabs;               // Slabs des Caches
+    uint64_t hits;                // Konstruiertes Objekt aus der Free-List
+    uint64_t misses;              // Neues Objekt geschnitten (Konstruktor lief)
+    struct kmem_cache* next;
+} kmem_cache_t;
+
+// align 0 = 16 Bytes; ctor darf NULL sein
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align,
+                                void (*ctor)(void* obj));
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+// Nur für Caches ohne ausgegebene Objekte
+void kmem_cache_destroy(kmem_cache_t* cache);
+// Erster Cache der Liste (weiter über ->next)
+kmem_cache_t* kmem_cache_list(void);
+
+/*
+ * Per-CPU Magazine für kmalloc
+ *
+ * Jede CPU hat pro Size Class ein geladenes und ein vorheriges Magazin
+ * (Bonwick). kmalloc/kfree nehmen bzw. legen Objekte im geladenen Magazin
+ * ab und fassen dabei nur cpu_data an. Erst wenn beide Magazine leer bzw.
+ * voll sind, wird ein ganzes Magazin mit dem globalen Depot getauscht.
+ */
+#define HEAP_SIZE_CLASSES 16
+#define HEAP_MAG_SIZE     14   // Objekte pro Magazin (Magazin = 128 Bytes)
+#define HEAP_DEPOT_MAX    4    // Volle Magazine pro Size Class im Depot
+
+typedef struct heap_magazine {
+    struct heap_magazine* next;      // Depot-Liste
+    uint64_t count;
+    void* objs[HEAP_MAG_SIZE];       // oben = zuletzt freigegeben
+} heap_magazine_t;
+
+typedef struct {
+    heap_magazine_t* loaded[HEAP_SIZE_CLASSES];
+    heap_magazine_t* previous[HEAP_SIZE_CLASSES];   // Immer voll oder leer
+    uint64_t hits;                   // Aus dem/in das Magazin bedient
+    uint64_t misses;                 // Depot oder Slab Layer nötig
+} __attribute__((packed)) heap_cpu_cache_t;
+
+// Magazine der aktuellen CPU und das Depot an die Slabs zurückgeben
+void heap_drain_magazines(void);
+
+// Heap Allocator Functions (Caches bis PAGE_SIZE, darüber direkt aus dem PMM)
 void heap_init(void);
 void* kmalloc(size_t size);
 void kfree(void* ptr);
 
+// Leere Slabs unmappen und ihre Pages an den PMM geben (Rückgabe: Pages)
+uint64_t heap_shrink(void);
+// Aus dem Idle Loop: heap_shrink, solange freier Speicher knapp ist
+void heap_reclaim_idle(void);
+
 // Heap Statistics
 uint64_t heap_total_allocated(void);
 uint64_t heap_current_size(void);
+uint64_t heap_slabs(void);
+uint64_t heap_empty_slabs(void);
+uint64_t heap_released_slabs(void);
+uint64_t heap_reclaimed_pages(void);
+uint64_t heap_window_size(void);
+uint64_t heap_magazine_hits(void);
+uint64_t heap_magazine_misses(void);
 
 #endif /* KIOS_HEAP_H */
@@ -14,124 +14,1604 @@ extern uint8_t __kernel_end;
 #include "pmm.h"
 #include "memory_map.h"
 #include "vga.h"
+#include "cpu.h"
+#include "syscall.h"
+#include "vmm.h"
+#include "acpi.h"
 
 #define PAGE_SIZE 4096
 
-static uint8_t *bitmap;
+/*
+ * Hierarchische Bitmap
+ *
+ * Level 0 enthält ein Bit pro Eintrag (1 = frei). Jedes höhere Level enthält
+ * ein Bit pro 64-Bit Wort des darunterliegenden Levels (1 = Wort hat noch
+ * mindestens ein freies Bit). Die Suche steigt vom obersten Level ab und
+ * braucht pro Level nur ein tzcnt - unabhängig von RAM-Größe und Belegung.
+ *
+ * 4 Levels reichen für 64^4 * 64 Pages (= 4 TB bei 4 KB Pages).
+ */
+#define HBM_MAX_LEVELS 4
+
+typedef struct {
+	uint64_t *level[HBM_MAX_LEVELS];   // level[0] = ein Bit pro Eintrag
+	uint64_t words[HBM_MAX_LEVELS];    // Anzahl Wörter pro Level
+	uint32_t depth;                    // Anzahl genutzter Levels
+} hbm_t;
+
+/*
+ * Buddy Allocator
+ *
+ * Pro Order k (Blockgröße 2^k Pages) gibt es eine hierarchische Bitmap:
+ * Bit i gesetzt = der Block ab Page (i << k) ist frei und nicht Teil eines
+ * größeren freien Blocks. Beim Allokieren wird ein größerer Block bei Bedarf
+ * halbiert, beim Freigeben wird mit dem freien Buddy (Index i ^ 1) so lange
+ * verschmolzen, bis der Buddy belegt ist oder PMM_MAX_ORDER erreicht ist.
+ *
+ * Jede Zone hat ihren eigenen Buddy Allocator. Die Zonengrenzen (16 MB,
+ * 4 GB) sind auf die größte Blockgröße ausgerichtet, daher werden Blöcke
+ * nie über Zonengrenzen hinweg verschmolzen.
+ *
+ * Bei NUMA bekommt jeder Knoten einen eigenen Satz Zonen (zones[] ist
+ * nach Knoten gruppiert: Index = node * PMM_ZONE_COUNT + Zonentyp). Die
+ * Knotengrenzen werden ebenfalls auf die größte Blockgröße gerundet.
+ */
+typedef struct {
+	const char *name;
+	uint64_t start_pfn;                     // Erste Page der Zone
+	uint64_t end_pfn;                       // Erste Page nach der Zone
+	uint64_t present_pages;                 // Nutzbare Pages laut E820
+	uint64_t free_pages;                    // Aktuell im Buddy Allocator frei
+	hbm_t free_area[PMM_MAX_ORDER + 1];     // Index relativ zu start_pfn
+} pmm_zone_t;
+
+static const char *const zone_names[PMM_ZONE_COUNT] = {
+	[PMM_ZONE_DMA16]  = "DMA16",
+	[PMM_ZONE_DMA32]  = "DMA32",
+	[PMM_ZONE_NORMAL] = "Normal",
+};
+
+/* Erste Page jedes Zonentyps, zone_limits[t + 1] = Ende von Typ t */
+static const uint64_t zone_limits[PMM_ZONE_COUNT + 1] = {
+	0,
+	0x1000000 / PAGE_SIZE,
+	0x100000000ULL / PAGE_SIZE,
+	(uint64_t)-1,
+};
+
+/* NUMA-Knoten: zusammenhängender PFN-Bereich mit eigener Proximity Domain */
+typedef struct {
+	uint32_t proximity;                     // ACPI Proximity Domain
+	uint64_t start_pfn;
+	uint64_t end_pfn;
+} pmm_node_t;
+
+static pmm_zone_t zones[PMM_MAX_NODES * PMM_ZONE_COUNT];
+static pmm_node_t nodes[PMM_MAX_NODES];
+static uint32_t node_count = 1;
+static uint32_t zone_count = PMM_ZONE_COUNT;
+static uint32_t local_node;                 // Knoten der (einzigen) CPU
+
+/*
+ * CMA-Bereich (Contiguous Memory Allocator)
+ *
+ * Beim Boot reservierter, zusammenhängender Bereich mit eigenem Buddy
+ * Allocator. Normale Allokationen sehen ihn nicht; bewegliche Pages
+ * (pmm_alloc_movable_page) dürfen ihn ausleihen, wenn der übrige Speicher
+ * erschöpft ist. pmm_cma_alloc() räumt bei Bedarf ein Fenster frei, indem
+ * die ausgeliehenen Pages in normale Zonen migriert werden.
+ */
+static pmm_zone_t cma_zone = { .name = "CMA" };
+static uint64_t cma_allocs;
+
+static inline int pfn_in_cma(uint64_t page)
+{
+	return page >= cma_zone.start_pfn && page < cma_zone.end_pfn;
+}
+
+/*
+ * Stage2 mappt nur das erste 1 GB identisch. Frames darüber sind erst über
+ * die Direct Map erreichbar und werden daher zunächst zurückgehalten, bis
+ * vmm_init() sie aufgebaut hat (pmm_online_high_memory).
+ */
+#define PMM_IDENTITY_LIMIT (0x40000000ULL / PAGE_SIZE)
+
+/* Boot-Stack aus entry.asm (rsp = 0x500000), bleibt als Idle-Stack in Benutzung */
+#define BOOT_STACK_TOP  0x500000ULL
+#define BOOT_STACK_SIZE 0x10000ULL
+
 static uint64_t total_pages;
 static uint64_t used_pages;
 
-void pmm_init(void)
+/* Boot-Kosten von pmm_init() in CPU-Zyklen */
+static uint64_t init_cycles;
+
+/* Latenz-Statistik für pmm_alloc_page() */
+static uint64_t alloc_calls;
+static uint64_t alloc_cycles_total;
+static uint64_t alloc_cycles_max;
+
+/* Frühe Allokationen (Metadaten) in einem freien Fenster (pmm_early_window) */
+static uint64_t early_alloc_ptr;
+
+/* Frame-Metadaten, ein page_t pro PFN (siehe pmm.h) */
+static page_t *page_array;
+
+static inline uint64_t bit_ffs64(uint64_t word)
+{
+	return (uint64_t)__builtin_ctzll(word);  // tzcnt/bsf
+}
+
+/* Ohne libgcc: popcount per Bit-Tricks statt __builtin_popcountll */
+static inline uint64_t bit_popcount64(uint64_t word)
+{
+	word = word - ((word >> 1) & 0x5555555555555555ULL);
+	word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+	word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (word * 0x0101010101010101ULL) >> 56;
+}
+
+/* Wörter mit rep stosq füllen (memset für die Mitte von Bereichen) */
+static inline void memset64(uint64_t *dest, uint64_t value, uint64_t count)
+{
+	__asm__ volatile("rep stosq"
+		: "+D"(dest), "+c"(count)
+		: "a"(value)
+		: "memory");
+}
+
+/* Wörter mit rep movsq kopieren (Page-Migration) */
+static inline void memcpy64(uint64_t *dest, const uint64_t *src, uint64_t count)
+{
+	__asm__ volatile("rep movsq"
+		: "+D"(dest), "+S"(src), "+c"(count)
+		:
+		: "memory");
+}
+
+static void *pmm_early_alloc(uint64_t size)
+{
+	void *ptr = (void *)early_alloc_ptr;
+	early_alloc_ptr = (early_alloc_ptr + size + 7) & ~7ULL;
+	return ptr;
+}
+
+static void hbm_init(hbm_t *h, uint64_t bits)
+{
+	uint64_t words = (bits + 63) / 64;
+
+	h->depth = 0;
+	while (h->depth < HBM_MAX_LEVELS)
+	{
+		h->words[h->depth] = words;
+		h->level[h->depth] = pmm_early_alloc(words * sizeof(uint64_t));
+		memset64(h->level[h->depth], 0, words);
+		h->depth++;
+
+		if (words == 1)
+			break;
+		words = (words + 63) / 64;
+	}
+}
+
+/* Speicherbedarf von hbm_init() für bits Einträge */
+static uint64_t hbm_bytes(uint64_t bits)
+{
+	uint64_t words = (bits + 63) / 64;
+	uint64_t bytes = 0;
+
+	for (uint32_t d = 0; d < HBM_MAX_LEVELS; d++)
+	{
+		bytes += words * sizeof(uint64_t);
+		if (words == 1)
+			break;
+		words = (words + 63) / 64;
+	}
+	return bytes;
+}
+
+/* Summary-Levels komplett aus Level 0 neu aufbauen (nach Boot-Setup) */
+static void hbm_rebuild(hbm_t *h)
+{
+	for (uint32_t l = 1; l < h->depth; l++)
+	{
+		for (uint64_t i = 0; i < h->words[l]; i++)
+		{
+			h->level[l][i] = 0;
+		}
+		for (uint64_t i = 0; i < h->words[l - 1]; i++)
+		{
+			if (h->level[l - 1][i])
+			{
+				h->level[l][i / 64] |= 1ULL << (i % 64);
+			}
+		}
+	}
+}
+
+static inline int hbm_test(hbm_t *h, uint64_t idx)
+{
+	return (h->level[0][idx / 64] >> (idx % 64)) & 1;
+}
+
+static void hbm_set(hbm_t *h, uint64_t idx)
+{
+	for (uint32_t l = 0; l < h->depth; l++)
+	{
+		uint64_t *word = &h->level[l][idx / 64];
+		uint64_t was = *word;
+		*word = was | (1ULL << (idx % 64));
+		if (was)
+			break;  // Höhere Levels wissen schon, dass hier etwas frei ist
+		idx /= 64;
+	}
+}
+
+static void hbm_clear(hbm_t *h, uint64_t idx)
+{
+	for (uint32_t l = 0; l < h->depth; l++)
+	{
+		uint64_t *word = &h->level[l][idx / 64];
+		*word &= ~(1ULL << (idx % 64));
+		if (*word)
+			break;  // Wort hat noch freie Bits -> Summary bleibt gesetzt
+		idx /= 64;
+	}
+}
+
+/* Niedrigstes gesetztes Bit finden, oder (uint64_t)-1 */
+static uint64_t hbm_find_first(hbm_t *h)
+{
+	uint32_t top = h->depth - 1;
+	uint64_t idx = (uint64_t)-1;
+
+	for (uint64_t i = 0; i < h->words[top]; i++)
+	{
+		if (h->level[top][i])
+		{
+			idx = i * 64 + bit_ffs64(h->level[top][i]);
+			break;
+		}
+	}
+	if (idx == (uint64_t)-1)
+		return idx;
+
+	for (int l = (int)top - 1; l >= 0; l--)
+	{
+		idx = idx * 64 + bit_ffs64(h->level[l][idx]);
+	}
+	return idx;
+}
+
+static pmm_zone_t *zone_of(uint64_t page)
+{
+	if (pfn_in_cma(page))
+		return &cma_zone;
+	for (uint32_t z = 0; z < zone_count; z++)
+	{
+		if (page >= zones[z].start_pfn && page < zones[z].end_pfn)
+			return &zones[z];
+	}
+	return 0;
+}
+
+/* Prüft ob eine Page in irgendeinem freien Block liegt */
+static int buddy_is_free(pmm_zone_t *zone, uint64_t page)
+{
+	uint64_t rel = page - zone->start_pfn;
+	for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++)
+	{
+		if (hbm_test(&zone->free_area[k], rel >> k))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Bits [start, end) setzen bzw. löschen: Teilwörter an den Rändern per
+ * Maske, alles dazwischen wortweise am Stück.
+ */
+static void bitmap_fill_range(uint64_t *bitmap, uint64_t start, uint64_t end, int set)
+{
+	if (start >= end)
+		return;
+
+	uint64_t first = start / 64;
+	uint64_t last = (end - 1) / 64;
+	uint64_t head = ~0ULL << (start % 64);
+	uint64_t tail = ~0ULL >> (63 - ((end - 1) % 64));
+
+	if (first == last)
+	{
+		head &= tail;
+		bitmap[first] = set ? (bitmap[first] | head) : (bitmap[first] & ~head);
+		return;
+	}
+
+	bitmap[first] = set ? (bitmap[first] | head) : (bitmap[first] & ~head);
+	memset64(&bitmap[first + 1], set ? ~0ULL : 0, last - first - 1);
+	bitmap[last] = set ? (bitmap[last] | tail) : (bitmap[last] & ~tail);
+}
+
+/* Flache Boot-Bitmap: Level 0 der Order-0 Bitmap, Bereich auf Zonen aufteilen */
+static void boot_mark_range(uint64_t start, uint64_t end, int free)
+{
+	if (end > total_pages)
+		end = total_pages;
+
+	for (uint32_t z = 0; z < zone_count; z++)
+	{
+		pmm_zone_t *zone = &zones[z];
+		uint64_t s = start > zone->start_pfn ? start : zone->start_pfn;
+		uint64_t e = end < zone->end_pfn ? end : zone->end_pfn;
+		if (s < e)
+		{
+			bitmap_fill_range(zone->free_area[0].level[0],
+				s - zone->start_pfn, e - zone->start_pfn, free);
+		}
+	}
+}
+
+/* Gerade Bits (0, 2, ..., 62) eines Worts in die unteren 32 Bits packen */
+static inline uint64_t bit_compress_even(uint64_t x)
+{
+	x &= 0x5555555555555555ULL;
+	x = (x | (x >> 1)) & 0x3333333333333333ULL;
+	x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+	x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+	return x;
+}
+
+/*
+ * Flache Bitmap einer Zone in Buddy-Blöcke umwandeln
+ *
+ * Pro Order werden 32 Buddy-Paare pro Wort gleichzeitig geprüft: sind beide
+ * Hälften frei, wandert das Paar als ein Bit in die nächsthöhere Order.
+ * Kosten O(Wörter) statt O(Pages).
+ */
+static void zone_build_buddy(pmm_zone_t *zone)
+{
+	uint64_t free = 0;
+	hbm_t *area = zone->free_area;
+
+	for (uint64_t i = 0; i < area[0].words[0]; i++)
+	{
+		free += bit_popcount64(area[0].level[0][i]);
+	}
+	zone->free_pages = free;
+
+	for (uint32_t k = 0; k < PMM_MAX_ORDER; k++)
+	{
+		uint64_t *lower = area[k].level[0];
+		uint64_t *upper = area[k + 1].level[0];
+
+		for (uint64_t i = 0; i < area[k].words[0]; i++)
+		{
+			uint64_t pairs = lower[i] & (lower[i] >> 1) & 0x5555555555555555ULL;
+			if (!pairs)
+				continue;
+
+			lower[i] &= ~(pairs | (pairs << 1));
+			upper[i / 2] |= bit_compress_even(pairs) << ((i % 2) * 32);
+		}
+	}
+
+	for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++)
+	{
+		hbm_rebuild(&area[k]);
+	}
+}
+
+/* Prüft ob [start, end) laut Boot-Bitmap komplett frei ist (ganze Wörter) */
+static int boot_range_free(uint64_t start, uint64_t end)
+{
+	pmm_zone_t *zone = zone_of(start);
+	if (!zone || end > zone->end_pfn)
+		return 0; // Bereich darf keine Zonengrenze überspannen
+
+	uint64_t *bitmap = zone->free_area[0].level[0];
+	for (uint64_t i = (start - zone->start_pfn) / 64; i < (end - zone->start_pfn) / 64; i++)
+	{
+		if (bitmap[i] != ~0ULL)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * CMA-Bereich aus dem freien, identisch gemappten Speicher herauslösen
+ *
+ * Gesucht wird von oben in Blöcken der größten Order (beide Grenzen damit
+ * wortausgerichtet). Der Bereich verschwindet aus den normalen Zonen und
+ * wird in cma_zone als frei eingetragen.
+ */
+static uint64_t cma_pages(void)
+{
+	uint64_t chunk = 1ULL << PMM_MAX_ORDER;
+	return ((PMM_CMA_SIZE_MB * 0x100000ULL / PAGE_SIZE) + chunk - 1) & ~(chunk - 1);
+}
+
+static void cma_reserve(void)
+{
+	uint64_t chunk = 1ULL << PMM_MAX_ORDER;
+	uint64_t pages = cma_pages();
+	uint64_t top = total_pages < PMM_IDENTITY_LIMIT ? total_pages : PMM_IDENTITY_LIMIT;
+	top &= ~(chunk - 1);
+
+	if (pages == 0 || pages > top)
+		return;
+
+	/* Bitmaps vorher anlegen und reservieren, damit die Suche sie nicht erwischt */
+	uint64_t meta = early_alloc_ptr;
+	for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++)
+	{
+		hbm_init(&cma_zone.free_area[k], (pages >> k) + 1);
+	}
+	boot_mark_range(meta / PAGE_SIZE, (early_alloc_ptr + PAGE_SIZE - 1) / PAGE_SIZE, 0);
+
+	for (uint64_t end = top; end >= pages; end -= chunk)
+	{
+		uint64_t start = end - pages;
+		if (!boot_range_free(start, end))
+			continue;
+
+		zone_of(start)->present_pages -= pages;
+		boot_mark_range(start, end, 0);
+
+		cma_zone.start_pfn = start;
+		cma_zone.end_pfn = end;
+		cma_zone.present_pages = pages;
+		bitmap_fill_range(cma_zone.free_area[0].level[0], 0, pages, 1);
+		return;
+	}
+}
+
+/*
+ * NUMA-Knoten aus der ACPI SRAT bestimmen
+ *
+ * Die Speicherbereiche werden pro Proximity Domain zusammengefasst, nach
+ * Adresse sortiert und lückenlos auf [0, total_pages) verteilt (Löcher
+ * gehören zum vorherigen Knoten, Grenzen auf 2^PMM_MAX_ORDER Pages
+ * abgerundet). Ohne SRAT gibt es genau einen Knoten.
+ */
+static void numa_init(void)
+{
+	acpi_mem_affinity_t ranges[PMM_NUMA_MAX_RANGES];
+	uint32_t count = acpi_srat_memory(ranges, PMM_NUMA_MAX_RANGES);
+
+	node_count = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint64_t start = ranges[i].base / PAGE_SIZE;
+		uint64_t end = (ranges[i].base + ranges[i].length) / PAGE_SIZE;
+		if (start >= total_pages)
+			continue;
+
+		uint32_t n = 0;
+		while (n < node_count && nodes[n].proximity != ranges[i].proximity)
+			n++;
+		if (n == node_count)
+		{
+			if (node_count == PMM_MAX_NODES)
+				continue; // Zu viele Knoten: Bereich fällt dem Nachbarn zu
+			nodes[n].proximity = ranges[i].proximity;
+			nodes[n].start_pfn = start;
+			nodes[n].end_pfn = end;
+			node_count++;
+		}
+		if (start < nodes[n].start_pfn)
+			nodes[n].start_pfn = start;
+		if (end > nodes[n].end_pfn)
+			nodes[n].end_pfn = end;
+	}
+
+	if (node_count == 0)
+	{
+		node_count = 1;
+		nodes[0].proximity = 0;
+	}
+
+	/* Nach Startadresse sortieren (Insertion Sort, wenige Knoten) */
+	for (uint32_t i = 1; i < node_count; i++)
+	{
+		pmm_node_t tmp = nodes[i];
+		uint32_t j = i;
+		while (j > 0 && nodes[j - 1].start_pfn > tmp.start_pfn)
+		{
+			nodes[j] = nodes[j - 1];
+			j--;
+		}
+		nodes[j] = tmp;
+	}
+
+	nodes[0].start_pfn = 0;
+	for (uint32_t i = 1; i < node_count; i++)
+	{
+		uint64_t start = nodes[i].start_pfn & ~((1ULL << PMM_MAX_ORDER) - 1);
+		if (start < nodes[i - 1].start_pfn)
+			start = nodes[i - 1].start_pfn;
+		nodes[i].start_pfn = start;
+		nodes[i - 1].end_pfn = start;
+	}
+	nodes[node_count - 1].end_pfn = total_pages;
+	zone_count = node_count * PMM_ZONE_COUNT;
+
+	/* Lokaler Knoten = Knoten der CPU laut SRAT */
+	uint32_t proximity;
+	local_node = 0;
+	if (acpi_srat_cpu_proximity(cpu_apic_id(), &proximity))
+	{
+		for (uint32_t n = 0; n < node_count; n++)
+		{
+			if (nodes[n].proximity == proximity)
+				local_node = n;
+		}
+	}
+}
+
+/*
+ * Fenster für die frühen Metadaten suchen
+ *
+ * Niedrigste Page-ausgerichtete Adresse in einem nutzbaren E820-Eintrag
+ * unterhalb von PMM_IDENTITY_LIMIT, an der size Bytes weder die ersten 1MB,
+ * das Kernel-Image, den Boot-Stack noch einen anderen E820-Eintrag
+ * überdecken. Die Metadaten werden genullt, bevor diese Bereiche reserviert
+ * sind - direkt hinter dem Kernel würde page_array ab ~480MB RAM in den
+ * Boot-Stack wachsen. Rückgabe 0, wenn nichts passt.
+ */
+static uint64_t pmm_early_window(memory_map_entry_t *entries, uint16_t count, uint64_t size)
+{
+	uint64_t avoid[3][2] = {
+		{ 0, 0x100000 },
+		{ (uint64_t)&__kernel_start, (uint64_t)&__kernel_end },
+		{ BOOT_STACK_TOP - BOOT_STACK_SIZE, BOOT_STACK_TOP },
+	};
+	uint64_t best = 0;
+
+	for (uint16_t i = 0; i < count; i++)
+	{
+		if (entries[i].type != 1)
+			continue;
+
+		uint64_t start = (entries[i].base + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+		uint64_t end = (entries[i].base + entries[i].length) & ~(PAGE_SIZE - 1);
+		if (end > PMM_IDENTITY_LIMIT * PAGE_SIZE)
+			end = PMM_IDENTITY_LIMIT * PAGE_SIZE;
+
+		/* Hinter jedes überlappende Hindernis schieben, bis keines mehr trifft */
+		uint64_t base = start;
+		int moved = 1;
+		while (moved && base < end)
+		{
+			moved = 0;
+			for (uint32_t a = 0; a < 3; a++)
+			{
+				if (base < avoid[a][1] && base + size > avoid[a][0])
+				{
+					base = (avoid[a][1] + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+					moved = 1;
+				}
+			}
+			for (uint16_t j = 0; j < count; j++)
+			{
+				uint64_t r_start = entries[j].base;
+				uint64_t r_end = entries[j].base + entries[j].length;
+				if (entries[j].type == 1 || base >= r_end || base + size <= r_start)
+					continue;
+				base = (r_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+				moved = 1;
+			}
+		}
+
+		if (base + size <= end && (best == 0 || base < best))
+			best = base;
+	}
+	return best;
+}
+
+void pmm_init(void)
+{
+	uint64_t t0 = rdtsc();
+	uint16_t count = memory_map_entry_count();
+	memory_map_entry_t *entries = memory_map_entries();
+
+	/* Höchste nutzbare Adresse bestimmen (reservierte MMIO-Löcher zählen nicht) */
+	uint64_t max_addr = 0;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		uint64_t end = entries[i].base + entries[i].length;
+		if (entries[i].type == 1 && end > max_addr)
+		{
+			max_addr = end;
+		}
+	}
+
+	total_pages = max_addr / PAGE_SIZE;
+
+	numa_init();
+
+	/* Zonen jedes Knotens auf dessen Adressbereich zuschneiden */
+	for (uint32_t z = 0; z < zone_count; z++)
+	{
+		pmm_node_t *node = &nodes[z / PMM_ZONE_COUNT];
+		uint32_t type = z % PMM_ZONE_COUNT;
+
+		zones[z].name = zone_names[type];
+		zones[z].start_pfn = zone_limits[type] > node->start_pfn ? zone_limits[type] : node->start_pfn;
+		zones[z].end_pfn = zone_limits[type + 1] < node->end_pfn ? zone_limits[type + 1] : node->end_pfn;
+		if (zones[z].start_pfn > zones[z].end_pfn)
+			zones[z].start_pfn = zones[z].end_pfn;
+	}
+
+	/* Bedarf der frühen Metadaten: page_array, Buddy-Bitmaps und CMA-Bitmaps */
+	uint64_t meta_size = total_pages * sizeof(page_t);
+	for (uint32_t z = 0; z < zone_count; z++)
+	{
+		uint64_t span = zones[z].end_pfn - zones[z].start_pfn;
+		for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++)
+		{
+			meta_size += hbm_bytes((span >> k) + 1);
+		}
+	}
+	for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++)
+	{
+		meta_size += hbm_bytes((cma_pages() >> k) + 1);
+	}
+	meta_size = (meta_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	/* Metadaten (page_t Array, Bitmaps) in freiem Speicher abseits von Kernel und Boot-Stack */
+	uint64_t meta_start = pmm_early_window(entries, count, meta_size);
+	if (meta_start == 0)
+	{
+		vga_print("[PMM] FEHLER: Kein Platz fuer die Frame-Metadaten\n");
+		meta_start = ((uint64_t)&__kernel_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	}
+	early_alloc_ptr = meta_start;
+
+	/* Frame-Metadaten zuerst, damit das Array Cache-Line-ausgerichtet ist */
+	page_array = pmm_early_alloc(total_pages * sizeof(page_t));
+	memset64((uint64_t *)page_array, 0, total_pages * sizeof(page_t) / sizeof(uint64_t));
+
+	for (uint32_t z = 0; z < zone_count; z++)
+	{
+		uint64_t span = zones[z].end_pfn - zones[z].start_pfn;
+		for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++)
+		{
+			hbm_init(&zones[z].free_area[k], (span >> k) + 1);
+		}
+	}
+
+	/*
+	 * Level 0 der Order-0 Bitmaps dient beim Boot als flache Bitmap aller
+	 * freien Pages. Nutzbare E820-Einträge werden nach innen auf ganze Pages
+	 * gerundet, alle anderen nach außen - und erst danach eingetragen, damit
+	 * reservierte Bereiche bei Überlappungen immer gewinnen.
+	 */
+	for (uint16_t i = 0; i < count; i++)
+	{
+		if (entries[i].type != 1)
+			continue;
+
+		uint64_t start = (entries[i].base + PAGE_SIZE - 1) / PAGE_SIZE;
+		uint64_t end = (entries[i].base + entries[i].length) / PAGE_SIZE;
+		boot_mark_range(start, end, 1);
+	}
+	for (uint16_t i = 0; i < count; i++)
+	{
+		if (entries[i].type == 1)
+			continue;
+
+		uint64_t start = entries[i].base / PAGE_SIZE;
+		uint64_t end = (entries[i].base + entries[i].length + PAGE_SIZE - 1) / PAGE_SIZE;
+		boot_mark_range(start, end, 0);
+	}
+
+	for (uint32_t z = 0; z < zone_count; z++)
+	{
+		hbm_t *h = &zones[z].free_area[0];
+		for (uint64_t i = 0; i < h->words[0]; i++)
+		{
+			zones[z].present_pages += bit_popcount64(h->level[0][i]);
+		}
+	}
+
+	/* Reserviere die ersten 1MB (BIOS, Bootloader, etc.) */
+	boot_mark_range(0, 0x100000 / PAGE_SIZE, 0);
+
+	/* Boot-Stack (entry.asm) - wird vom Idle-Task weiter benutzt */
+	boot_mark_range((BOOT_STACK_TOP - BOOT_STACK_SIZE) / PAGE_SIZE, BOOT_STACK_TOP / PAGE_SIZE, 0);
+
+	/* Kernel-Image reservieren */
+	uint64_t kernel_start = (uint64_t)&__kernel_start;
+	uint64_t kernel_end = (uint64_t)&__kernel_end;
+	boot_mark_range(kernel_start / PAGE_SIZE, (kernel_end + PAGE_SIZE - 1) / PAGE_SIZE, 0);
+
+	/* Bitmaps und Frame-Metadaten reservieren (ganzes Fenster, inkl. CMA-Bitmaps) */
+	boot_mark_range(meta_start / PAGE_SIZE, (meta_start + meta_size) / PAGE_SIZE, 0);
+
+	/* Nicht identisch gemappten Speicher zurückhalten */
+	boot_mark_range(PMM_IDENTITY_LIMIT, total_pages, 0);
+
+	/* CMA-Bereich herauslösen */
+	cma_reserve();
+
+	/* Freie Bereiche pro Zone in Buddy-Blöcke umwandeln */
+	used_pages = total_pages;
+	for (uint32_t z = 0; z < zone_count; z++)
+	{
+		zone_build_buddy(&zones[z]);
+		used_pages -= zones[z].free_pages;
+	}
+	if (cma_zone.present_pages)
+	{
+		zone_build_buddy(&cma_zone);
+		used_pages -= cma_zone.free_pages;
+	}
+
+	init_cycles = rdtsc() - t0;
+
+	// PMM initialisiert - keine Ausgabe für sauberes Boot
+}
+
+static void* buddy_alloc(pmm_zone_t *zone, uint32_t order) {
+	if (order > PMM_MAX_ORDER) {
+		return 0;
+	}
+
+	/* Kleinsten freien Block mit Order >= order suchen */
+	uint32_t k = order;
+	uint64_t idx = (uint64_t)-1;
+	for (; k <= PMM_MAX_ORDER; k++) {
+		idx = hbm_find_first(&zone->free_area[k]);
+		if (idx != (uint64_t)-1) {
+			break;
+		}
+	}
+	if (idx == (uint64_t)-1) {
+		return 0; // Zone erschöpft
+	}
+	hbm_clear(&zone->free_area[k], idx);
+
+	/* Block halbieren bis er passt, obere Hälfte bleibt jeweils frei */
+	while (k > order) {
+		k--;
+		idx *= 2;
+		hbm_set(&zone->free_area[k], idx + 1);
+	}
+
+	zone->free_pages -= 1ULL << order;
+	used_pages += 1ULL << order;
+	return (void*)((zone->start_pfn + (idx << order)) * PAGE_SIZE);
+}
+
+static void buddy_free(void* phys, uint32_t order) {
+	uint64_t page = (uint64_t)phys / PAGE_SIZE;
+	if (order > PMM_MAX_ORDER || page + (1ULL << order) > total_pages) {
+		return;
+	}
+	if (page & ((1ULL << order) - 1)) {
+		return; // Nicht an der Blockgröße ausgerichtet
+	}
+	pmm_zone_t *zone = zone_of(page);
+	if (buddy_is_free(zone, page)) {
+		return; // Doppeltes Free ignorieren
+	}
+	zone->free_pages += 1ULL << order;
+	used_pages -= 1ULL << order;
+
+	/* Mit freiem Buddy verschmelzen */
+	uint64_t idx = (page - zone->start_pfn) >> order;
+	while (order < PMM_MAX_ORDER && hbm_test(&zone->free_area[order], idx ^ 1)) {
+		hbm_clear(&zone->free_area[order], idx ^ 1);
+		idx >>= 1;
+		order++;
+	}
+	hbm_set(&zone->free_area[order], idx);
+}
+
+/*
+ * Speicher oberhalb des Identity-Mappings freigeben
+ *
+ * Läuft nach vmm_init(), wenn alle Frames über die Direct Map erreichbar
+ * sind. Nutzbare E820-Bereiche (ohne überlappende reservierte Einträge)
+ * gehen in möglichst großen ausgerichteten Blöcken an den Buddy Allocator.
+ */
+static void online_range(uint64_t start, uint64_t end, uint16_t from)
+{
+	uint16_t count = memory_map_entry_count();
+	memory_map_entry_t *entries = memory_map_entries();
+
+	if (start >= end)
+		return;
+
+	/* Überlappende reservierte Einträge ausschneiden */
+	for (uint16_t i = from; i < count; i++)
+	{
+		if (entries[i].type == 1)
+			continue;
+
+		uint64_t rs = entries[i].base / PAGE_SIZE;
+		uint64_t re = (entries[i].base + entries[i].length + PAGE_SIZE - 1) / PAGE_SIZE;
+		if (rs < end && re > start)
+		{
+			online_range(start, rs, i + 1);
+			online_range(re, end, i + 1);
+			return;
+		}
+	}
+
+	while (start < end)
+	{
+		uint32_t order = 0;
+		while (order < PMM_MAX_ORDER && !(start & ((2ULL << order) - 1)) &&
+			start + (2ULL << order) <= end)
+			order++;
+
+		buddy_free((void *)(start * PAGE_SIZE), order);
+		start += 1ULL << order;
+	}
+}
+
+void pmm_online_high_memory(void)
 {
+	if (total_pages <= PMM_IDENTITY_LIMIT || vmm_direct_map_offset == 0)
+		return;
+
 	uint16_t count = memory_map_entry_count();
 	memory_map_entry_t *entries = memory_map_entries();
 
-	/* maximale physische Adresse bestimmen */
-	uint64_t max_addr = 0;
+	uint64_t flags = cpu_irq_save();
 	for (uint16_t i = 0; i < count; i++)
 	{
-		uint64_t end = entries[i].base + entries[i].length;
-		if (end > max_addr)
-		{
-			max_addr = end;
+		if (entries[i].type != 1)
+			continue;
+
+		uint64_t start = (entries[i].base + PAGE_SIZE - 1) / PAGE_SIZE;
+		uint64_t end = (entries[i].base + entries[i].length) / PAGE_SIZE;
+		if (start < PMM_IDENTITY_LIMIT)
+			start = PMM_IDENTITY_LIMIT;
+		online_range(start, end, 0);
+	}
+	cpu_irq_restore(flags);
+}
+
+/*
+ * Frame-Metadaten
+ *
+ * Der Refcount wird nur am ersten Frame eines Blocks geführt. Erhöht wird
+ * er auch außerhalb des PMM-Locks (vmm_map_page), deshalb atomar.
+ */
+page_t* pmm_phys_to_page(uint64_t phys) {
+	uint64_t page = phys / PAGE_SIZE;
+	return page < total_pages ? &page_array[page] : 0;
+}
+
+uint64_t pmm_page_to_phys(page_t* page) {
+	return (uint64_t)(page - page_array) * PAGE_SIZE;
+}
+
+/* Frisch vergebenen Block übernehmen: eine Referenz, keine Mappings */
+static inline void page_set_allocated(void *phys, uint32_t order) {
+	page_t *page = &page_array[(uint64_t)phys / PAGE_SIZE];
+	page->refcount = 1;
+	page->mapcount = 0;
+	page->flags = 0;
+	page->order = (uint8_t)order;
+	page->owner_pml4 = 0;
+	page->owner = 0;
+}
+
+/* Referenz abgeben; gibt 1 zurück, wenn es die letzte war */
+static int page_put(page_t *page) {
+	if (!page || page->refcount == 0) {
+		return 0; // Nicht vergeben (frei, reserviert oder doppeltes Free)
+	}
+	return __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+void pmm_page_get(void* phys) {
+	page_t *page = pmm_phys_to_page((uint64_t)phys);
+	if (page && page->refcount) {
+		__atomic_add_fetch(&page->refcount, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* Nur vergebene Frames werden gezählt - MMIO und Boot-Bereiche bleiben außen vor */
+void pmm_page_map(void* phys) {
+	page_t *page = pmm_phys_to_page((uint64_t)phys);
+	if (page && page->refcount) {
+		__atomic_add_fetch(&page->refcount, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&page->mapcount, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void pmm_page_set_movable(void* phys, uint64_t pml4_phys, uint64_t virt) {
+	page_t *page = pmm_phys_to_page((uint64_t)phys);
+	if (page && page->refcount) {
+		page->owner = virt & ~(PAGE_SIZE - 1);
+		page->owner_pml4 = (uint32_t)(pml4_phys / PAGE_SIZE);
+		page->flags |= PG_MOVABLE;
+	}
+}
+
+void pmm_page_unmap(void* phys) {
+	page_t *page = pmm_phys_to_page((uint64_t)phys);
+	if (page && page->mapcount) {
+		__atomic_sub_fetch(&page->mapcount, 1, __ATOMIC_RELAXED);
+		pmm_free_page(phys);
+	}
+}
+
+/*
+ * Zonen in Fallback-Reihenfolge: erst alle Zonen des gewünschten Knotens,
+ * dann die übrigen Knoten; innerhalb eines Knotens hoher Speicher zuerst,
+ * knappe DMA-Zonen zuletzt.
+ */
+static void* zone_alloc(uint32_t order, uint32_t zone_mask, uint32_t node) {
+	for (uint32_t i = 0; i < node_count; i++) {
+		pmm_zone_t *node_zones = &zones[((node + i) % node_count) * PMM_ZONE_COUNT];
+		for (int t = PMM_ZONE_COUNT - 1; t >= 0; t--) {
+			if (!(zone_mask & (1U << t)) || node_zones[t].free_pages < (1ULL << order)) {
+				continue;
+			}
+			void *block = buddy_alloc(&node_zones[t], order);
+			if (block) {
+				return block;
+			}
 		}
 	}
+	return 0;
+}
+
+/*
+ * Globaler Pfad: Interrupts gesperrt, solange der Buddy Allocator
+ * verändert wird. Das ist der einzige Serialisierungspunkt im PMM.
+ */
+void* pmm_alloc_pages_node(uint32_t order, uint32_t zone_mask, uint32_t node) {
+	if (node >= node_count) {
+		node = local_node;
+	}
 
-	total_pages = max_addr / PAGE_SIZE;
+	uint64_t flags = cpu_irq_save();
+	void *block = zone_alloc(order, zone_mask, node);
+	cpu_irq_restore(flags);
+
+	if (!block && order > 0) {
+		/* Gecachte Einzel-Frames zurückgeben, damit Buddies verschmelzen */
+		pmm_drain_cpu_cache();
+		flags = cpu_irq_save();
+		block = zone_alloc(order, zone_mask, node);
+		cpu_irq_restore(flags);
+	}
+	if (!block && order > 0 && pmm_compact(order, zone_mask)) {
+		flags = cpu_irq_save();
+		block = zone_alloc(order, zone_mask, node);
+		cpu_irq_restore(flags);
+	}
+	if (block) {
+		page_set_allocated(block, order);
+	}
+	return block;
+}
+
+void* pmm_alloc_pages_zone(uint32_t order, uint32_t zone_mask) {
+	return pmm_alloc_pages_node(order, zone_mask, local_node);
+}
+
+void* pmm_alloc_pages(uint32_t order) {
+	return pmm_alloc_pages_zone(order, PMM_ZONE_ANY);
+}
+
+/* Die Order kommt aus den Frame-Metadaten, der Parameter dient nur als Kontrolle */
+void pmm_free_pages(void* phys, uint32_t order) {
+	page_t *page = pmm_phys_to_page((uint64_t)phys);
+	if (!page || page->order != order) {
+		return;
+	}
+	if (order == 0) {
+		pmm_free_page(phys);
+		return;
+	}
+	if (!page_put(page)) {
+		return; // Noch referenziert
+	}
 
-	/* Bitmap nach Kernel Ende */
-	uint64_t bitmap_size = (total_pages + 7) / 8;
-	bitmap = (uint8_t *)(((uint64_t)&__kernel_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+	uint64_t flags = cpu_irq_save();
+	buddy_free(phys, order);
+	cpu_irq_restore(flags);
+}
 
-	/* Alles als belegt markieren */
-	for (uint64_t i = 0; i < bitmap_size; i++)
+/*
+ * Per-CPU Cache
+ *
+ * Order-0 Allokationen laufen über ein kleines LIFO-Magazin in cpu_data_t.
+ * Der schnelle Pfad fasst nur CPU-lokale Daten an (Interrupts kurz aus,
+ * damit kein Task-Switch dazwischenkommt). Nur wenn das Magazin leer bzw.
+ * voll ist, werden PMM_PCP_BATCH Frames am Stück mit dem Buddy Allocator
+ * getauscht.
+ */
+static void pcp_refill(pmm_cpu_cache_t *pcp)
+{
+	while (pcp->count < PMM_PCP_BATCH)
 	{
-		bitmap[i] = 0xFF;
+		void *page = zone_alloc(0, PMM_ZONE_ANY, local_node);
+		if (!page)
+			break;
+		pcp->frames[pcp->count++] = (uint64_t)page;
 	}
-	used_pages = total_pages;
+}
 
-	for (uint16_t i = 0; i < count; i++)
+/* Die ältesten (kältesten) Frames unten aus dem Magazin zurückgeben */
+static void pcp_drain(pmm_cpu_cache_t *pcp, uint64_t count)
+{
+	if (count > pcp->count)
+		count = pcp->count;
+
+	for (uint64_t i = 0; i < count; i++)
 	{
-		if (entries[i].type != 1)
-			continue;
+		buddy_free((void *)pcp->frames[i], 0);
+	}
+	for (uint64_t i = count; i < pcp->count; i++)
+	{
+		pcp->frames[i - count] = pcp->frames[i];
+	}
+	pcp->count -= count;
+}
 
-		uint64_t start = entries[i].base / PAGE_SIZE;
-		uint64_t pages = entries[i].length / PAGE_SIZE;
+void pmm_drain_cpu_cache(void) {
+	uint64_t flags = cpu_irq_save();
+	pmm_cpu_cache_t *pcp = &cpu_current()->pmm_cache;
+	pcp_drain(pcp, pcp->count);
+	cpu_irq_restore(flags);
+}
+
+void* pmm_alloc_page(void) {
+	uint64_t t0 = rdtsc();
+
+	uint64_t flags = cpu_irq_save();
+	pmm_cpu_cache_t *pcp = &cpu_current()->pmm_cache;
+	if (pcp->count == 0) {
+		pcp_refill(pcp);
+	}
+	void *page = pcp->count ? (void*)pcp->frames[--pcp->count] : 0;
+	cpu_irq_restore(flags);
+
+	if (!page) {
+		return 0; // Kein Speicher frei
+	}
+	page_set_allocated(page, 0);
+
+	uint64_t cycles = rdtsc() - t0;
+	alloc_calls++;
+	alloc_cycles_total += cycles;
+	if (cycles > alloc_cycles_max) {
+		alloc_cycles_max = cycles;
+	}
+
+	return page;
+}
+
+/* Gibt eine Referenz ab - der Frame wird erst mit der letzten frei */
+void pmm_free_page(void* phys) {
+	page_t *page = pmm_phys_to_page((uint64_t)phys);
+	if (!page_put(page)) {
+		return;
+	}
+
+	uint64_t flags = cpu_irq_save();
+	uint64_t pfn = (uint64_t)phys / PAGE_SIZE;
+	if (page->order != 0 || pfn < zone_limits[PMM_ZONE_DMA16 + 1] || pfn_in_cma(pfn)) {
+		/* Blöcke, knappe DMA16- und CMA-Frames direkt an den Buddy Allocator */
+		buddy_free(phys, page->order);
+		cpu_irq_restore(flags);
+		return;
+	}
+
+	pmm_cpu_cache_t *pcp = &cpu_current()->pmm_cache;
+	if (pcp->count == PMM_PCP_SIZE) {
+		pcp_drain(pcp, PMM_PCP_BATCH);
+	}
+	pcp->frames[pcp->count++] = (uint64_t)phys;
+	cpu_irq_restore(flags);
+}
+
+/*
+ * Kompaktierung
+ *
+ * Zieht bewegliche Pages (Heap- und User-Pages mit genau einem Mapping,
+ * siehe pmm_page_set_movable) aus einem ausgerichteten Zielblock in freie
+ * Frames derselben Zone um und biegt ihr PTE im Adressraum des Besitzers
+ * (owner_pml4) auf den neuen Frame. Sind alle belegten Frames des Blocks
+ * umgezogen, verschmilzt der Buddy Allocator ihn wieder zu einem Block der
+ * gewünschten Order.
+ *
+ * Zielblöcke werden von oben gesucht, Ersatz-Frames liefert buddy_alloc()
+ * von unten (niedrigster freier Index) - belegte Pages wandern also nach
+ * unten, der freie Speicher sammelt sich am oberen Ende der Zone.
+ */
+static uint64_t compact_runs;
+static uint64_t compact_success;
+static uint64_t compact_migrated;
+static uint64_t compact_idle_free_pages = (uint64_t)-1;
 
-		for (uint64_t p = 0; p < pages; p++)
+/*
+ * Beweglich = markiert, genau ein Mapping und höchstens noch die
+ * Allokations-Referenz (Heap behält sie, User-Pages geben sie ab)
+ */
+static inline int page_movable(page_t *page)
+{
+	return (page->flags & PG_MOVABLE) && page->mapcount == 1 &&
+		page->refcount <= page->mapcount + 1;
+}
+
+/*
+ * Eine Page in den bereits allozierten Frame dst umziehen (Interrupts
+ * müssen aus sein). Die Page des aktuellen Stacks bleibt liegen:
+ * Schreibzugriffe zwischen Kopie und PTE-Wechsel gingen sonst verloren.
+ * Bei Misserfolg gehört dst weiter dem Aufrufer.
+ */
+static __attribute__((noinline)) int compact_migrate(uint64_t pfn, void *dst)
+{
+	page_t *old = &page_array[pfn];
+	uint64_t virt = old->owner;
+	uint64_t rsp;
+	__asm__ volatile("mov %%rsp, %0" : "=r"(rsp));
+	rsp &= ~(PAGE_SIZE - 1);
+	if (virt + PAGE_SIZE >= rsp && virt <= rsp + PAGE_SIZE)
+		return 0;
+
+	uint64_t new_pfn = (uint64_t)dst / PAGE_SIZE;
+	memcpy64((uint64_t *)phys_to_virt((uint64_t)dst), (uint64_t *)phys_to_virt(pfn * PAGE_SIZE),
+		PAGE_SIZE / sizeof(uint64_t));
+	if (!vmm_migrate_page((uint64_t)old->owner_pml4 * PAGE_SIZE, virt, pfn * PAGE_SIZE, (uint64_t)dst))
+		return 0; // Mapping passt nicht (mehr) zum Owner
+
+	page_array[new_pfn] = *old;
+	old->refcount = 0;
+	old->mapcount = 0;
+	old->flags = 0;
+	old->owner = 0;
+	buddy_free((void *)(pfn * PAGE_SIZE), 0);
+	compact_migrated++;
+	return 1;
+}
+
+/* Einen Zielblock der Order frei räumen, von oben nach unten */
+static int compact_zone(pmm_zone_t *zone, uint32_t order)
+{
+	uint64_t size = 1ULL << order;
+	uint64_t blocks = (zone->end_pfn - zone->start_pfn) >> order;
+
+	for (uint64_t b = blocks; b-- > 0;)
+	{
+		uint64_t start = zone->start_pfn + (b << order);
+		uint64_t moves = 0;
+		int movable = 1;
+
+		for (uint64_t p = start; p < start + size; p++)
+		{
+			if (buddy_is_free(zone, p))
+				continue;
+			if (!page_movable(&page_array[p]))
+			{
+				movable = 0;
+				break;
+			}
+			moves++;
+		}
+		/* Außerhalb des Blocks müssen genug Frames für alle Umzüge frei sein */
+		if (!movable || moves == 0 || zone->free_pages - (size - moves) < moves)
+			continue;
+
+		uint64_t flags = cpu_irq_save();
+		for (uint64_t p = start; p < start + size; p++)
 		{
-			uint64_t idx = start + p;
-			uint64_t byte = idx / 8;
-			uint8_t bit = 1 << (idx % 8);
+			if (buddy_is_free(zone, p) || !page_movable(&page_array[p]))
+				continue;
 
-			if (bitmap[byte] & bit)
+			/* Ziel-Frame aus derselben Zone, aber außerhalb des Blocks */
+			void *dst = buddy_alloc(zone, 0);
+			if (!dst)
+				break;
+			uint64_t dst_pfn = (uint64_t)dst / PAGE_SIZE;
+			if ((dst_pfn >= start && dst_pfn < start + size) || !compact_migrate(p, dst))
 			{
-				bitmap[byte] &= ~bit;
-				used_pages--;
+				buddy_free(dst, 0);
+				break;
 			}
 		}
+		int done = hbm_test(&zone->free_area[order], b);
+		cpu_irq_restore(flags);
+
+		if (done)
+			return 1;
 	}
+	return 0;
+}
 
-	/* Reserviere die ersten 1MB (BIOS, Bootloader, etc.) */
-	uint64_t reserved_1mb_pages = 0x100000 / PAGE_SIZE; // 1MB = 256 pages
-	for (uint64_t p = 0; p < reserved_1mb_pages; p++)
+int pmm_compact(uint32_t order, uint32_t zone_mask)
+{
+	if (order == 0 || order > PMM_MAX_ORDER)
+		return 0;
+
+	/* Gecachte Frames blockieren sonst das Verschmelzen im Zielblock */
+	pmm_drain_cpu_cache();
+
+	compact_runs++;
+	for (uint32_t i = 0; i < node_count; i++)
 	{
-		uint64_t byte = p / 8;
-		uint8_t bit = 1 << (p % 8);
-		if (!(bitmap[byte] & bit))
+		pmm_zone_t *node_zones = &zones[((local_node + i) % node_count) * PMM_ZONE_COUNT];
+		for (int t = PMM_ZONE_COUNT - 1; t >= 0; t--)
 		{
-			bitmap[byte] |= bit;
-			used_pages++;
+			if (!(zone_mask & (1U << t)) || node_zones[t].free_pages < (1ULL << order))
+				continue;
+			if (compact_zone(&node_zones[t], order))
+			{
+				compact_success++;
+				return 1;
+			}
 		}
 	}
+	return 0;
+}
 
-	/* Kernel und Bitmap reservieren */
-	uint64_t kernel_start = (uint64_t)&__kernel_start;
-	uint64_t kernel_end = (uint64_t)bitmap + bitmap_size;
-	uint64_t start_page = kernel_start / PAGE_SIZE;
-	uint64_t end_page = (kernel_end + PAGE_SIZE - 1) / PAGE_SIZE;
+/*
+ * Leerlauf: dafür sorgen, dass ein Block der Größe PMM_COMPACT_IDLE_ORDER
+ * frei ist, obwohl genug Speicher frei wäre. Nach einem erfolglosen Lauf
+ * erst wieder, wenn sich die Zahl freier Pages geändert hat.
+ */
+void pmm_compact_idle(void)
+{
+	if (pmm_free_blocks(PMM_COMPACT_IDLE_ORDER) > 0)
+		return;
 
-	for (uint64_t p = start_page; p < end_page; p++)
+	uint64_t free = total_pages - used_pages;
+	if (free < (2ULL << PMM_COMPACT_IDLE_ORDER) || free == compact_idle_free_pages)
+		return;
+
+	if (!pmm_compact(PMM_COMPACT_IDLE_ORDER, PMM_ZONE_ANY))
+		compact_idle_free_pages = total_pages - used_pages;
+}
+
+/*
+ * Fragmentierungsindex in Prozent: Anteil der freien Pages, die nur in
+ * Blöcken kleiner als 2^order liegen und eine Allokation dieser Order
+ * nicht bedienen können (0 = unfragmentiert, 100 = nichts nutzbar).
+ */
+uint64_t pmm_frag_index(uint32_t order)
+{
+	if (order > PMM_MAX_ORDER)
+		return 0;
+
+	uint64_t free = 0;
+	uint64_t usable = 0;
+	for (uint32_t z = 0; z < zone_count; z++)
+		free += zones[z].free_pages;
+	for (uint32_t k = order; k <= PMM_MAX_ORDER; k++)
+		usable += pmm_free_blocks(k) << k;
+
+	return free ? ((free - usable) * 100) / free : 0;
+}
+
+/*
+ * CMA-Allokation
+ *
+ * Sucht von oben ein ausgerichtetes Fenster aus count Pages, in dem jede
+ * Page frei oder beweglich ist, zieht die beweglichen in normale Zonen um
+ * und nimmt das Fenster dann komplett aus dem CMA-Buddy heraus. Jede Page
+ * bekommt einen eigenen Refcount (Freigabe per pmm_cma_free/pmm_free_page).
+ */
+
+/* Freien Block, der page enthält, herauslösen; Reste außerhalb [start, end) zurückgeben */
+static void cma_take_block(uint64_t page, uint64_t start, uint64_t end)
+{
+	pmm_zone_t *zone = &cma_zone;
+	uint64_t rel = page - zone->start_pfn;
+	for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++)
 	{
-		uint64_t byte = p / 8;
-		uint8_t bit = 1 << (p % 8);
-		if (!(bitmap[byte] & bit))
+		if (!hbm_test(&zone->free_area[k], rel >> k))
+			continue;
+
+		hbm_clear(&zone->free_area[k], rel >> k);
+		zone->free_pages -= 1ULL << k;
+		used_pages += 1ULL << k;
+
+		uint64_t block = zone->start_pfn + ((rel >> k) << k);
+		for (uint64_t p = block; p < block + (1ULL << k); p++)
 		{
-			bitmap[byte] |= bit;
-			used_pages++;
+			if (p < start || p >= end)
+				buddy_free((void *)(p * PAGE_SIZE), 0);
 		}
+		return;
 	}
+}
 
-	// PMM initialisiert - keine Ausgabe für sauberes Boot
+/* Bewegliche Pages aus [start, end) auslagern; 1 wenn das Fenster danach frei ist */
+static int cma_evacuate(uint64_t start, uint64_t end)
+{
+	for (uint64_t p = start; p < end; p++)
+	{
+		if (buddy_is_free(&cma_zone, p))
+			continue;
+		if (!page_movable(&page_array[p]))
+			return 0;
+
+		void *dst = zone_alloc(0, PMM_ZONE_ANY, local_node);
+		if (!dst)
+			return 0;
+		if (!compact_migrate(p, dst))
+		{
+			buddy_free(dst, 0);
+			return 0;
+		}
+	}
+	return 1;
 }
 
-void* pmm_alloc_page(void) {
-    for (uint64_t i = 0; i < total_pages; i++) {
-        uint64_t byte = i / 8;
-        uint8_t  bit  = 1 << (i % 8);
-        if (!(bitmap[byte] & bit)) {
-            bitmap[byte] |= bit;
-            used_pages++;
-            return (void*)(i * PAGE_SIZE);
-        }
-    }
-    return 0; // Kein Speicher frei
+void* pmm_cma_alloc(uint64_t count)
+{
+	uint64_t size = cma_zone.end_pfn - cma_zone.start_pfn;
+	if (count == 0 || count > size)
+		return 0;
+
+	/* Fenster auf die nächste Zweierpotenz ausrichten (max. größte Order) */
+	uint64_t align = 1;
+	while (align < count && align < (1ULL << PMM_MAX_ORDER))
+		align <<= 1;
+
+	pmm_drain_cpu_cache();
+
+	for (uint64_t off = (size - count) & ~(align - 1);; off -= align)
+	{
+		uint64_t start = cma_zone.start_pfn + off;
+		uint64_t end = start + count;
+		int usable = 1;
+
+		for (uint64_t p = start; p < end && usable; p++)
+		{
+			usable = buddy_is_free(&cma_zone, p) || page_movable(&page_array[p]);
+		}
+
+		if (usable)
+		{
+			uint64_t flags = cpu_irq_save();
+			if (cma_evacuate(start, end))
+			{
+				for (uint64_t p = start; p < end; p++)
+				{
+					if (buddy_is_free(&cma_zone, p))
+						cma_take_block(p, start, end);
+					page_set_allocated((void *)(p * PAGE_SIZE), 0);
+				}
+				cma_allocs++;
+				cpu_irq_restore(flags);
+				return (void *)(start * PAGE_SIZE);
+			}
+			cpu_irq_restore(flags);
+		}
+
+		if (off < align)
+			break;
+	}
+	return 0;
 }
 
-void pmm_free_page(void* phys) {
-	uint64_t page = (uint64_t)phys / PAGE_SIZE;
-	uint64_t byte = page / 8;
-	uint8_t  bit  = 1 << (page % 8);
-	if (bitmap[byte] & bit) {
-		bitmap[byte] &= ~bit;
-		used_pages--;
+void pmm_cma_free(void* phys, uint64_t count)
+{
+	for (uint64_t i = 0; i < count; i++)
+	{
+		pmm_free_page((uint8_t *)phys + i * PAGE_SIZE);
+	}
+}
+
+/* Bewegliche Page: erst normaler Speicher, dann aus dem CMA-Bereich leihen */
+void* pmm_alloc_movable_page(void)
+{
+	void *page = pmm_alloc_page();
+	if (page || !cma_zone.present_pages)
+		return page;
+
+	uint64_t flags = cpu_irq_save();
+	page = buddy_alloc(&cma_zone, 0);
+	cpu_irq_restore(flags);
+
+	if (page)
+		page_set_allocated(page, 0);
+	return page;
+}
+
+uint64_t pmm_cma_base(void) {
+	return cma_zone.start_pfn * PAGE_SIZE;
+}
+
+uint64_t pmm_cma_pages(void) {
+	return cma_zone.present_pages;
+}
+
+uint64_t pmm_cma_free_pages(void) {
+	return cma_zone.free_pages;
+}
+
+uint64_t pmm_cma_allocs(void) {
+	return cma_allocs;
+}
+
+uint64_t pmm_compact_runs(void) {
+	return compact_runs;
+}
+
+uint64_t pmm_compact_success(void) {
+	return compact_success;
+}
+
+uint64_t pmm_compact_migrated(void) {
+	return compact_migrated;
+}
+
+/*
+ * Pool vorab genullter Pages
+ *
+ * Der Idle-Task nullt freie Pages im Hintergrund und legt sie hier ab.
+ * pmm_alloc_zeroed_page() nimmt sie ohne Nullen vom Pool; nur wenn er leer
+ * ist, wird inline genullt (Miss).
+ */
+static uint64_t zero_pool[PMM_ZERO_POOL_SIZE];
+static uint64_t zero_pool_count;
+static uint64_t zero_pool_hits;
+static uint64_t zero_pool_misses;
+
+void* pmm_alloc_zeroed_page(void) {
+	uint64_t flags = cpu_irq_save();
+	void *page = zero_pool_count ? (void*)zero_pool[--zero_pool_count] : 0;
+	if (page) {
+		zero_pool_hits++;
+	} else {
+		zero_pool_misses++;
+	}
+	cpu_irq_restore(flags);
+
+	if (!page) {
+		page = pmm_alloc_page();
+		if (page) {
+			memset64((uint64_t*)phys_to_virt((uint64_t)page), 0, PAGE_SIZE / sizeof(uint64_t));
+		}
+	}
+	return page;
+}
+
+void pmm_zero_pool_refill(void) {
+	while (zero_pool_count < PMM_ZERO_POOL_SIZE) {
+		void *page = pmm_alloc_page();
+		if (!page) {
+			return;
+		}
+
+		/* Nullen mit Interrupts an - die Page gehört bis zum Einhängen nur uns */
+		memset64((uint64_t*)phys_to_virt((uint64_t)page), 0, PAGE_SIZE / sizeof(uint64_t));
+
+		uint64_t flags = cpu_irq_save();
+		if (zero_pool_count < PMM_ZERO_POOL_SIZE) {
+			zero_pool[zero_pool_count++] = (uint64_t)page;
+			page = 0;
+		}
+		cpu_irq_restore(flags);
+
+		if (page) {
+			pmm_free_page(page);  // Pool wurde zwischendurch voll
+		}
 	}
 }
 
+uint64_t pmm_zero_pool_pages(void) {
+	return zero_pool_count;
+}
+
+uint64_t pmm_zero_pool_hits(void) {
+	return zero_pool_hits;
+}
+
+uint64_t pmm_zero_pool_misses(void) {
+	return zero_pool_misses;
+}
+
 uint64_t pmm_total_pages(void) {
 	return total_pages;
 }
 
+/* Frames im CPU-Cache und im Zero-Pool sind für den Buddy Allocator belegt, aber frei */
 uint64_t pmm_used_pages(void) {
-	return used_pages;
-}
\ No newline at end of file
+	return used_pages - pmm_cached_pages() - zero_pool_count;
+}
+
+uint64_t pmm_cached_pages(void) {
+	return cpu_current()->pmm_cache.count;
+}
+
+uint64_t pmm_free_blocks(uint32_t order) {
+	if (order > PMM_MAX_ORDER) {
+		return 0;
+	}
+	uint64_t blocks = 0;
+	for (uint32_t z = 0; z < zone_count; z++) {
+		hbm_t *h = &zones[z].free_area[order];
+		for (uint64_t i = 0; i < h->words[0]; i++) {
+			blocks += bit_popcount64(h->level[0][i]);
+		}
+	}
+	return blocks;
+}
+
+const char* pmm_zone_name(uint32_t zone) {
+	return zone < PMM_ZONE_COUNT ? zone_names[zone] : "?";
+}
+
+/* Zonen-Statistik über alle Knoten summiert */
+uint64_t pmm_zone_present_pages(uint32_t zone) {
+	uint64_t pages = 0;
+	for (uint32_t z = zone; z < zone_count; z += PMM_ZONE_COUNT) {
+		pages += zones[z].present_pages;
+	}
+	return pages;
+}
+
+uint64_t pmm_zone_free_pages(uint32_t zone) {
+	uint64_t pages = 0;
+	for (uint32_t z = zone; z < zone_count; z += PMM_ZONE_COUNT) {
+		pages += zones[z].free_pages;
+	}
+	return pages;
+}
+
+uint32_t pmm_node_count(void) {
+	return node_count;
+}
+
+uint32_t pmm_local_node(void) {
+	return local_node;
+}
+
+uint32_t pmm_node_proximity(uint32_t node) {
+	return node < node_count ? nodes[node].proximity : 0;
+}
+
+uint64_t pmm_node_start(uint32_t node) {
+	return node < node_count ? nodes[node].start_pfn * PAGE_SIZE : 0;
+}
+
+uint64_t pmm_node_end(uint32_t node) {
+	return node < node_count ? nodes[node].end_pfn * PAGE_SIZE : 0;
+}
+
+uint64_t pmm_node_present_pages(uint32_t node) {
+	uint64_t pages = 0;
+	for (uint32_t t = 0; node < node_count && t < PMM_ZONE_COUNT; t++) {
+		pages += zones[node * PMM_ZONE_COUNT + t].present_pages;
+	}
+	return pages;
+}
+
+uint64_t pmm_node_free_pages(uint32_t node) {
+	uint64_t pages = 0;
+	for (uint32_t t = 0; node < node_count && t < PMM_ZONE_COUNT; t++) {
+		pages += zones[node * PMM_ZONE_COUNT + t].free_pages;
+	}
+	return pages;
+}
+
+uint64_t pmm_init_cycles(void) {
+	return init_cycles;
+}
+
+uint64_t pmm_alloc_calls(void) {
+	return alloc_calls;
+}
+
+uint64_t pmm_alloc_avg_cycles(void) {
+	return alloc_calls ? alloc_cycles_total / alloc_calls : 0;
+}
+
+uint64_t pmm_alloc_max_cycles(void) {
+	return alloc_cycles_max;
+}
@@ -6,9 +6,173 @@
 #pragma once
 #include "types.h"
 
+// Größte Buddy-Order: 2^10 Pages = 4 MB zusammenhängend
+#define PMM_MAX_ORDER 10
+
+// Physische Speicherzonen
+#define PMM_ZONE_DMA16   0    // < 16 MB (ISA DMA)
+#define PMM_ZONE_DMA32   1    // < 4 GB (32-Bit PCI DMA)
+#define PMM_ZONE_NORMAL  2    // Rest
+#define PMM_ZONE_COUNT   3
+
+// NUMA: Knoten aus der ACPI SRAT (ohne SRAT genau einer)
+#define PMM_MAX_NODES        4
+#define PMM_NUMA_MAX_RANGES  16   // SRAT Memory-Affinity Einträge
+
+// Zonenmasken für pmm_alloc_pages_zone()
+#define PMM_ZONE_MASK_DMA16   (1U << PMM_ZONE_DMA16)
+#define PMM_ZONE_MASK_DMA32   ((1U << PMM_ZONE_DMA32) | PMM_ZONE_MASK_DMA16)
+#define PMM_ZONE_ANY          ((1U << PMM_ZONE_COUNT) - 1)
+
+// CMA-Bereich in MB (Build-Option, z.B. make CMA_SIZE_MB=32; 0 = aus)
+#ifndef PMM_CMA_SIZE_MB
+#define PMM_CMA_SIZE_MB 16
+#endif
+
+// Per-CPU Page-Frame Cache (LIFO Magazin vor dem globalen Buddy Allocator)
+#define PMM_PCP_SIZE  32    // Kapazität pro CPU
+#define PMM_PCP_BATCH 16    // Frames pro Refill/Drain gegen den Buddy Allocator
+
+typedef struct {
+    uint64_t count;                  // Anzahl gecachter Frames
+    uint64_t frames[PMM_PCP_SIZE];   // Physische Adressen, oben = zuletzt frei
+} __attribute__((packed)) pmm_cpu_cache_t;
+
+/*
+ * Metadaten pro Frame (struct page)
+ *
+ * Für jeden physischen Frame gibt es einen Eintrag im page_t Array, das
+ * pmm_init() als erste Allokation im Metadaten-Fenster (pmm_early_window)
+ * anlegt, vor den Buddy- und CMA-Bitmaps. 32 Bytes pro Eintrag, also
+ * genau zwei Frames pro Cache Line.
+ *
+ * refcount 0 heißt: der Frame gehört niemandem (frei, im Cache oder beim
+ * Boot reserviert). pmm_alloc_*() setzt ihn auf 1, jedes Mapping über
+ * vmm_map_page() hält eine weitere Referenz. Freigegeben wird erst, wenn
+ * die letzte Referenz fällt. Bei Blöcken (order > 0) zählt nur der erste Frame.
+ */
+#define PG_PAGETABLE  (1 << 0)    // Frame ist eine Page-Table (PML4/PDPT/PD/PT)
+#define PG_LRU        (1 << 1)    // Frame hängt in einer LRU-Liste
+#define PG_MOVABLE    (1 << 2)    // Darf migriert werden (owner = virtuelle Adresse, owner_pml4)
+
+#define PG_LRU_NONE   0xFFFFFFFFU // Ende der LRU-Liste
+
+typedef struct page {
+    uint32_t refcount;    // Referenzen (0 = nicht vergeben)
+    uint32_t mapcount;    // Anzahl PTEs, die auf den Frame zeigen
+    uint16_t flags;       // PG_*
+    uint8_t  order;       // Blockgröße bei der Allokation (nur erster Frame)
+    uint8_t  _pad0;
+    uint32_t lru_next;    // LRU-Liste als PFN (PG_LRU_NONE = Ende)
+    uint32_t lru_prev;
+    union {
+        uint32_t pt_entries;  // Bei PG_PAGETABLE: belegte Entries der Tabelle
+        uint32_t owner_pml4;  // Bei PG_MOVABLE: PFN des PML4 mit dem Mapping
+    };
+    uint64_t owner;       // Besitzer (z.B. virtuelle Adresse des Mappings)
+} page_t;
+
+_Static_assert(sizeof(page_t) == 32, "page_t muss 32 Bytes groß sein");
+
+// Pool vorab genullter Pages (wird vom Idle-Task aufgefüllt)
+#define PMM_ZERO_POOL_SIZE 64
+
+// Im Leerlauf kompaktieren, bis ein 2 MB Block (Huge Page) frei ist
+#define PMM_COMPACT_IDLE_ORDER 9
+
 void pmm_init(void);
+
+// RAM oberhalb 1 GB freigeben, sobald vmm_init() die Direct Map aufgebaut hat
+void pmm_online_high_memory(void);
+
+// Order-0 Wrapper (einzelne 4 KB Page)
 void* pmm_alloc_page(void);
 void pmm_free_page(void* phys);
 
+// Genullte Page: aus dem Pool, sonst inline genullt
+void* pmm_alloc_zeroed_page(void);
+
+// Zero-Pool auffüllen (Idle-Task, Interrupts dürfen an sein)
+void pmm_zero_pool_refill(void);
+
+// 2^order physisch zusammenhängende Pages, ausgerichtet auf ihre Größe
+void* pmm_alloc_pages(uint32_t order);
+void pmm_free_pages(void* phys, uint32_t order);
+
+// Wie pmm_alloc_pages, aber nur aus den Zonen in zone_mask (höchste zuerst)
+void* pmm_alloc_pages_zone(uint32_t order, uint32_t zone_mask);
+
+// Page für bewegliche Daten (Heap, User): darf aus dem CMA-Bereich geliehen werden
+void* pmm_alloc_movable_page(void);
+
+// count physisch zusammenhängende Pages aus dem CMA-Bereich (z.B. DMA-Puffer)
+void* pmm_cma_alloc(uint64_t count);
+void pmm_cma_free(void* phys, uint64_t count);
+
+uint64_t pmm_cma_base(void);
+uint64_t pmm_cma_pages(void);
+uint64_t pmm_cma_free_pages(void);
+uint64_t pmm_cma_allocs(void);
+
+// Bevorzugt vom Knoten node, sonst Fallback auf die übrigen Knoten
+void* pmm_alloc_pages_node(uint32_t order, uint32_t zone_mask, uint32_t node);
+
+// Frame-Metadaten: 0 wenn phys außerhalb des verwalteten RAMs liegt
+page_t* pmm_phys_to_page(uint64_t phys);
+uint64_t pmm_page_to_phys(page_t* page);
+
+// Zusätzliche Referenz auf einen vergebenen Frame (Gegenstück: pmm_free_page)
+void pmm_page_get(void* phys);
+
+// Mapping-Zähler (von vmm_map_page/vmm_unmap_page, halten je eine Referenz)
+void pmm_page_map(void* phys);
+void pmm_page_unmap(void* phys);
+
+// Frame als beweglich markieren: einziges Mapping liegt bei virt im Adressraum
+// mit dem PML4 pml4_phys (Kompaktierung)
+void pmm_page_set_movable(void* phys, uint64_t pml4_phys, uint64_t virt);
+
 uint64_t pmm_total_pages(void);
-uint64_t pmm_used_pages(void);
\ No newline at end of file
+uint64_t pmm_used_pages(void);
+uint64_t pmm_free_blocks(uint32_t order);
+uint64_t pmm_cached_pages(void);
+
+uint64_t pmm_zero_pool_pages(void);
+uint64_t pmm_zero_pool_hits(void);
+uint64_t pmm_zero_pool_misses(void);
+
+const char* pmm_zone_name(uint32_t zone);
+uint64_t pmm_zone_present_pages(uint32_t zone);
+uint64_t pmm_zone_free_pages(uint32_t zone);
+
+uint32_t pmm_node_count(void);
+uint32_t pmm_local_node(void);
+uint32_t pmm_node_proximity(uint32_t node);
+uint64_t pmm_node_start(uint32_t node);
+uint64_t pmm_node_end(uint32_t node);
+uint64_t pmm_node_present_pages(uint32_t node);
+uint64_t pmm_node_free_pages(uint32_t node);
+
+// Bewegliche Pages aus einem Block der Order umziehen (1 = Block frei geräumt)
+int pmm_compact(uint32_t order, uint32_t zone_mask);
+
+// Kompaktierung im Leerlauf (Idle-Task)
+void pmm_compact_idle(void);
+
+// Fragmentierungsindex pro Order in Prozent (0 = alles nutzbar)
+uint64_t pmm_frag_index(uint32_t order);
+
+uint64_t pmm_compact_runs(void);
+uint64_t pmm_compact_success(void);
+uint64_t pmm_compact_migrated(void);
+
+// Gibt alle Frames aus dem Cache der aktuellen CPU an den Buddy Allocator zurück
+void pmm_drain_cpu_cache(void);
+
+// Boot-Kosten von pmm_init() in CPU-Zyklen (rdtsc)
+uint64_t pmm_init_cycles(void);
+
+// Latenz von pmm_alloc_page() in CPU-Zyklen (rdtsc)
+uint64_t pmm_alloc_calls(void);
+uint64_t pmm_alloc_avg_cycles(void);
+uint64_t pmm_alloc_max_cycles(void);
@@ -0,0 +1,615 @@
+// Copyright (c) 2026 KibaOfficial
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "vmalloc.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "heap.h"
+#include "cpu.h"
+
+/*
+ * Ein Bereich [start, end) im vmalloc-Fenster. Derselbe Knotentyp dient für
+ * freie Lücken (free_root, nach Adresse sortiert, mit subtree_max) und für
+ * belegte Bereiche (busy_root, end schließt die Guard Page ein).
+ */
+typedef struct vmap_area {
+    uint64_t start;
+    uint64_t end;
+    uint64_t subtree_max;         // Größter Bereich im Teilbaum (nur free_root)
+    struct vmap_area* parent;
+    struct vmap_area* left;
+    struct vmap_area* right;
+    int red;
+    struct vmap_area* next;       // Purge-Liste
+    void** frames;                // Gehaltene Frames (vmalloc/vmap), sonst NULL
+    uint64_t count;
+} vmap_area_t;
+
+static vmap_area_t* free_root = NULL;
+static vmap_area_t* busy_root = NULL;
+
+// Per vfree abgeräumt, aber noch nicht geflusht
+static vmap_area_t* purge_list = NULL;
+static uint64_t lazy_pages = 0;
+
+// Statistik
+static uint64_t busy_areas = 0;
+static uint64_t busy_pages = 0;
+static uint64_t purges = 0;
+
+/* =============================================================================
+ * Red-Black Tree (augmentiert mit der größten Lücke im Teilbaum)
+ * =============================================================================
+ */
+
+static uint64_t va_subtree_max(vmap_area_t* node) {
+    return node ? node->subtree_max : 0;
+}
+
+static void va_update(vmap_area_t* node) {
+    uint64_t max = node->end - node->start;
+    if (va_subtree_max(node->left) > max) {
+        max = node->left->subtree_max;
+    }
+    if (va_subtree_max(node->right) > max) {
+        max = node->right->subtree_max;
+    }
+    node->subtree_max = max;
+}
+
+// Helper: subtree_max von node bis zur Wurzel neu berechnen
+static void va_propagate(vmap_area_t* node) {
+    for (; node; node = node->parent) {
+        va_update(node);
+    }
+}
+
+// Helper: u im Baum durch v ersetzen (v darf NULL sein)
+static void va_transplant(vmap_area_t** root, vmap_area_t* u, vmap_area_t* v) {
+    if (!u->parent) {
+        *root = v;
+    } else if (u == u->parent->left) {
+        u->parent->left = v;
+    } else {
+        u->parent->right = v;
+    }
+    if (v) {
+        v->parent = u->parent;
+    }
+}
+
+// Rotationen ändern nur die Teilbäume von x und y, darüber bleibt subtree_max gültig
+static void va_rotate_left(vmap_area_t** root, vmap_area_t* x) {
+    vmap_area_t* y = x->right;
+    x->right = y->left;
+    if (y->left) {
+        y->left->parent = x;
+    }
+    va_transplant(root, x, y);
+    y->left = x;
+    x->parent = y;
+    va_update(x);
+    va_update(y);
+}
+
+static void va_rotate_right(vmap_area_t** root, vmap_area_t* x) {
+    vmap_area_t* y = x->left;
+    x->left = y->right;
+    if (y->right) {
+        y->right->parent = x;
+    }
+    va_transplant(root, x, y);
+    y->right = x;
+    x->parent = y;
+    va_update(x);
+    va_update(y);
+}
+
+static void va_insert(vmap_area_t** root, vmap_area_t* node) {
+    vmap_area_t* parent = NULL;
+    vmap_area_t** link = root;
+    while (*link) {
+        parent = *link;
+        link = node->start < parent->start ? &parent->left : &parent->right;
+    }
+
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = 1;
+    *link = node;
+    va_propagate(node);
+
+    // Rot-Rot Konflikte nach oben auflösen
+    while (node->parent && node->parent->red) {
+        vmap_area_t* p = node->parent;
+        vmap_area_t* g = p->parent;   // Existiert, die Wurzel ist schwarz
+
+        if (p == g->left) {
+            vmap_area_t* uncle = g->right;
+            if (uncle && uncle->red) {
+                p->red = uncle->red = 0;
+                g->red = 1;
+                node = g;
+                continue;
+            }
+            if (node == p->right) {
+                va_rotate_left(root, p);
+                p = node;
+            }
+            p->red = 0;
+            g->red = 1;
+            va_rotate_right(root, g);
+            break;
+        } else {
+            vmap_area_t* uncle = g->left;
+            if (uncle && uncle->red) {
+                p->red = uncle->red = 0;
+                g->red = 1;
+                node = g;
+                continue;
+            }
+            if (node == p->left) {
+                va_rotate_right(root, p);
+                p = node;
+            }
+            p->red = 0;
+            g->red = 1;
+            va_rotate_left(root, g);
+            break;
+        }
+    }
+    (*root)->red = 0;
+}
+
+static int va_is_black(vmap_area_t* node) {
+    return !node || !node->red;
+}
+
+// Helper: Doppelt-schwarz an x (Kind von parent, evtl. NULL) auflösen
+static void va_erase_fixup(vmap_area_t** root, vmap_area_t* x, vmap_area_t* parent) {
+    while (x != *root && va_is_black(x)) {
+        if (x == parent->left) {
+            vmap_area_t* w = parent->right;
+            if (w->red) {
+                w->red = 0;
+                parent->red = 1;
+                va_rotate_left(root, parent);
+                w = parent->right;
+            }
+            if (va_is_black(w->left) && va_is_black(w->right)) {
+                w->red = 1;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (va_is_black(w->right)) {
+                w->left->red = 0;
+                w->red = 1;
+                va_rotate_right(root, w);
+                w = parent->right;
+            }
+            w->red = parent->red;
+            parent->red = 0;
+            w->right->red = 0;
+            va_rotate_left(root, parent);
+        } else {
+            vmap_area_t* w = parent->left;
+            if (w->red) {
+                w->red = 0;
+                parent->red = 1;
+                va_rotate_right(root, parent);
+                w = parent->left;
+            }
+            if (va_is_black(w->left) && va_is_black(w->right)) {
+                w->red = 1;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (va_is_black(w->left)) {
+                w->right->red = 0;
+                w->red = 1;
+                va_rotate_left(root, w);
+                w = parent->left;
+            }
+            w->red = parent->red;
+            parent->red = 0;
+            w->left->red = 0;
+            va_rotate_right(root, parent);
+        }
+        x = *root;
+    }
+    if (x) {
+        x->red = 0;
+    }
+}
+
+static void va_erase(vmap_area_t** root, vmap_area_t* node) {
+    vmap_area_t* child;
+    vmap_area_t* parent;
+    int red;
+
+    if (!node->left || !node->right) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        red = node->red;
+        va_transplant(root, node, child);
+    } else {
+        // Nachfolger übernimmt den Platz von node
+        vmap_area_t* next = node->right;
+        while (next->left) {
+            next = next->left;
+        }
+        red = next->red;
+        child = next->right;
+
+        if (next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            va_transplant(root, next, next->right);
+            next->right = node->right;
+            next->right->parent = next;
+        }
+        va_transplant(root, node, next);
+        next->left = node->left;
+        next->left->parent = next;
+        next->red = node->red;
+    }
+
+    va_propagate(parent);
+    if (!red) {
+        va_erase_fixup(root, child, parent);
+    }
+}
+
+// Helper: Belegter Bereich, der genau bei start beginnt
+static vmap_area_t* va_find(vmap_area_t* node, uint64_t start) {
+    while (node && node->start != start) {
+        node = start < node->start ? node->left : node->right;
+    }
+    return node;
+}
+
+// Helper: Niedrigste freie Lücke mit mindestens size Bytes
+static vmap_area_t* va_find_lowest(uint64_t size) {
+    vmap_area_t* node = free_root;
+    while (node) {
+        if (va_subtree_max(node->left) >= size) {
+            node = node->left;
+        } else if (node->end - node->start >= size) {
+            return node;
+        } else if (va_subtree_max(node->right) >= size) {
+            node = node->right;
+        } else {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* =============================================================================
+ * Adressbereiche
+ * =============================================================================
+ */
+
+// Helper: [area->start, area->end) zurück in die freien Lücken, mit Nachbarn verschmelzen
+static void va_release(vmap_area_t* area) {
+    vmap_area_t* prev = NULL;
+    vmap_area_t* next = NULL;
+    for (vmap_area_t* node = free_root; node; ) {
+        if (node->start < area->start) {
+            prev = node;
+            node = node->right;
+        } else {
+            next = node;
+            node = node->left;
+        }
+    }
+
+    int join_prev = prev && prev->end == area->start;
+    int join_next = next && next->start == area->end;
+
+    if (join_prev && join_next) {
+        prev->end = next->end;
+        va_erase(&free_root, next);
+        va_propagate(prev);
+        kfree(next);
+        kfree(area);
+    } else if (join_prev) {
+        prev->end = area->end;
+        va_propagate(prev);
+        kfree(area);
+    } else if (join_next) {
+        // Startadresse ist der Schlüssel, die Reihenfolge bleibt aber erhalten
+        next->start = area->start;
+        va_propagate(next);
+        kfree(area);
+    } else {
+        area->frames = NULL;
+        area->count = 0;
+        va_insert(&free_root, area);
+    }
+}
+
+// Helper: Bereich mit size Bytes + Guard Page aus der niedrigsten passenden Lücke schneiden
+static vmap_area_t* va_alloc_locked(uint64_t size, uint64_t align) {
+    uint64_t need = size + VMALLOC_GUARD + (align - PAGE_SIZE);
+    vmap_area_t* gap = va_find_lowest(need);
+    if (!gap) {
+        return NULL;
+    }
+
+    uint64_t start = (gap->start + align - 1) & ~(align - 1);
+    uint64_t end = start + size + VMALLOC_GUARD;
+    vmap_area_t* area;
+
+    if (start == gap->start && end == gap->end) {
+        // Lücke passt genau: Knoten wechselt in den busy-Baum
+        va_erase(&free_root, gap);
+        area = gap;
+    } else {
+        area = (vmap_area_t*)kmalloc(sizeof(vmap_area_t));
+        if (!area) {
+            return NULL;
+        }
+
+        if (start == gap->start) {
+            gap->start = end;
+        } else if (end == gap->end) {
+            gap->end = start;
+        } else {
+            // Mitte: rechter Rest wird eine eigene Lücke
+            vmap_area_t* rest = (vmap_area_t*)kmalloc(sizeof(vmap_area_t));
+            if (!rest) {
+                kfree(area);
+                return NULL;
+            }
+            rest->start = end;
+            rest->end = gap->end;
+            gap->end = start;
+            va_insert(&free_root, rest);
+        }
+        va_propagate(gap);
+    }
+
+    area->start = start;
+    area->end = end;
+    area->frames = NULL;
+    area->count = 0;
+    va_insert(&busy_root, area);
+
+    busy_areas++;
+    busy_pages += size / PAGE_SIZE;
+    return area;
+}
+
+// Helper: Lazy abgeräumte Bereiche flushen, Frames und Adressen freigeben
+static void vmalloc_purge_locked(void) {
+    if (!purge_list) {
+        return;
+    }
+
+    // Ein globaler Flush für alle gesammelten Bereiche (Kernel-Mappings sind global)
+    vmm_flush_tlb_global();
+    purges++;
+
+    while (purge_list) {
+        vmap_area_t* area = purge_list;
+        purge_list = area->next;
+
+        for (uint64_t i = 0; i < area->count; i++) {
+            pmm_free_page(area->frames[i]);
+        }
+        kfree(area->frames);
+        va_release(area);
+    }
+    lazy_pages = 0;
+}
+
+static vmap_area_t* va_alloc(uint64_t size, uint64_t align) {
+    size = (size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (align < PAGE_SIZE) {
+        align = PAGE_SIZE;
+    }
+    if (size == 0 || (align & (align - 1))) {
+        return NULL;
+    }
+
+    uint64_t flags = cpu_irq_save();
+    vmap_area_t* area = va_alloc_locked(size, align);
+    if (!area && purge_list) {
+        // Vielleicht passt es nach dem Freigeben der wartenden Bereiche
+        vmalloc_purge_locked();
+        area = va_alloc_locked(size, align);
+    }
+    cpu_irq_restore(flags);
+    return area;
+}
+
+// Helper: Belegten Bereich austragen (NULL wenn addr keiner ist)
+static vmap_area_t* va_remove(void* addr) {
+    vmap_area_t* area = va_find(busy_root, (uint64_t)addr);
+    if (area) {
+        va_erase(&busy_root, area);
+        busy_areas--;
+        busy_pages -= (area->end - area->start - VMALLOC_GUARD) / PAGE_SIZE;
+    }
+    return area;
+}
+
+// Helper: Bereich sofort zurückgeben (nichts gemappt, Frames schon abgegeben)
+static void va_free(vmap_area_t* area) {
+    uint64_t flags = cpu_irq_save();
+    va_remove((void*)area->start);
+    va_release(area);
+    cpu_irq_restore(flags);
+}
+
+/* =============================================================================
+ * Public Funktionen
+ * =============================================================================
+ */
+
+void vmalloc_init(void) {
+    vmap_area_t* window = (vmap_area_t*)kmalloc(sizeof(vmap_area_t));
+    if (!window) {
+        return;
+    }
+    window->start = VMALLOC_START;
+    window->end = VMALLOC_END;
+    free_root = NULL;
+    va_insert(&free_root, window);
+}
+
+void* vmalloc(uint64_t size) {
+    vmap_area_t* area = va_alloc(size, PAGE_SIZE);
+    if (!area) {
+        return NULL;
+    }
+
+    uint64_t count = (area->end - area->start - VMALLOC_GUARD) / PAGE_SIZE;
+    void** frames = (void**)kmalloc(count * sizeof(void*));
+    uint64_t got = 0;
+    while (frames && got < count && (frames[got] = pmm_alloc_page())) {
+        got++;
+    }
+
+    // Die Allokations-Referenz bleibt beim Bereich, das Mapping nimmt eine eigene
+    if (got < count ||
+        !vmm_map_pages(&vmm_kernel_space, area->start, frames, count, PAGE_PRESENT | PAGE_WRITE)) {
+        for (uint64_t i = 0; i < got; i++) {
+            pmm_free_page(frames[i]);
+        }
+        kfree(frames);
+        va_free(area);
+        return NULL;
+    }
+
+    area->frames = frames;
+    area->count = count;
+    return (void*)area->start;
+}
+
+void* vmap(void* const* frames, uint64_t count, uint32_t flags) {
+    vmap_area_t* area = va_alloc(count * PAGE_SIZE, PAGE_SIZE);
+    if (!area) {
+        return NULL;
+    }
+
+    void** held = (void**)kmalloc(count * sizeof(void*));
+    if (!held || !vmm_map_pages(&vmm_kernel_space, area->start, frames, count, flags | PAGE_PRESENT)) {
+        kfree(held);
+        va_free(area);
+        return NULL;
+    }
+
+    // Frames dürfen erst nach dem (lazy) Flush frei werden
+    for (uint64_t i = 0; i < count; i++) {
+        held[i] = frames[i];
+        pmm_page_get(frames[i]);
+    }
+    area->frames = held;
+    area->count = count;
+    return (void*)area->start;
+}
+
+void vfree(void* addr) {
+    if (!addr) {
+        return;
+    }
+
+    uint64_t flags = cpu_irq_save();
+    vmap_area_t* area = va_remove(addr);
+    if (!area) {
+        cpu_irq_restore(flags);
+        return;
+    }
+
+    // Mappings weg, der Bereich bleibt bis zum Flush gesperrt
+    uint64_t size = area->end - area->start - VMALLOC_GUARD;
+    vmm_unmap_range_lazy(&vmm_kernel_space, area->start, size);
+    area->next = purge_list;
+    purge_list = area;
+    lazy_pages += size / PAGE_SIZE;
+
+    if (lazy_pages >= VMALLOC_LAZY_MAX) {
+        vmalloc_purge_locked();
+    }
+    cpu_irq_restore(flags);
+}
+
+void vunmap(void* addr) {
+    vfree(addr);
+}
+
+// Helper: [phys, phys + size) mit Cache-Modus cache mappen
+static void* ioremap_cache(uint64_t phys, uint64_t size, uint32_t cache) {
+    uint64_t offset = phys & (PAGE_SIZE - 1);
+    uint64_t base = phys - offset;
+    size = (size + offset + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+
+    // Gleiche Ausrichtung wie phys, damit vmm_map_range 2 MB Leaves nehmen kann
+    uint64_t align = (size >= VMM_2MB && !(base & (VMM_2MB - 1))) ? VMM_2MB : PAGE_SIZE;
+    vmap_area_t* area = va_alloc(size, align);
+    if (!area) {
+        return NULL;
+    }
+
+    if (!vmm_map_range(&vmm_kernel_space, area->start, base, size, PAGE_PRESENT | PAGE_WRITE | cache)) {
+        va_free(area);
+        return NULL;
+    }
+    return (void*)(area->start + offset);
+}
+
+void* ioremap(uint64_t phys, uint64_t size) {
+    return ioremap_cache(phys, size, PAGE_NOCACHE | PAGE_WRITETHROUGH);
+}
+
+void* ioremap_wc(uint64_t phys, uint64_t size) {
+    return ioremap_cache(phys, size, PAGE_WC);
+}
+
+void iounmap(void* addr) {
+    // Keine eigenen Frames: läuft wie vfree über den gesammelten Flush
+    vfree((void*)((uint64_t)addr & ~(uint64_t)(PAGE_SIZE - 1)));
+}
+
+void* get_vm_area(uint64_t size, uint64_t align) {
+    vmap_area_t* area = va_alloc(size, align);
+    return area ? (void*)area->start : NULL;
+}
+
+void free_vm_area(void* addr) {
+    uint64_t flags = cpu_irq_save();
+    vmap_area_t* area = va_remove(addr);
+    if (area) {
+        va_release(area);
+    }
+    cpu_irq_restore(flags);
+}
+
+void vmalloc_purge(void) {
+    uint64_t flags = cpu_irq_save();
+    vmalloc_purge_locked();
+    cpu_irq_restore(flags);
+}
+
+uint64_t vmalloc_areas(void) {
+    return busy_areas;
+}
+
+uint64_t vmalloc_used_pages(void) {
+    return busy_pages;
+}
+
+uint64_t vmalloc_lazy_pages(void) {
+    return lazy_pages;
+}
+
+uint64_t vmalloc_purges(void) {
+    return purges;
+}
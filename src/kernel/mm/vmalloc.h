@@ -0,0 +1,65 @@
+// Copyright (c) 2026 KibaOfficial
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+#include "types.h"
+
+/*
+ * vmalloc: virtuell zusammenhängende, physisch verstreute Kernel-Puffer
+ *
+ * Bereiche kommen aus einem eigenen Fenster der Kernel-Hälfte (PML4 Index
+ * 402). Freie Lücken liegen in einem Red-Black Tree nach Adresse, jeder
+ * Knoten kennt die größte Lücke in seinem Teilbaum - die niedrigste
+ * passende Lücke ist so in O(log n) gefunden. Hinter jedem Bereich bleibt
+ * eine ungemappte Guard Page, Überläufe enden im #PF statt im Nachbarn.
+ *
+ * vfree/vunmap entfernen nur die Mappings. Der TLB-Flush und die Freigabe
+ * von Frames und Adressbereich passieren gesammelt, sobald VMALLOC_LAZY_MAX
+ * Pages auf den Flush warten oder das Fenster voll ist (vmalloc_purge).
+ */
+#define VMALLOC_START     0xFFFFC90000000000ULL
+#define VMALLOC_END       (VMALLOC_START + 0x1000000000ULL)   // 64 GB
+#define VMALLOC_GUARD     4096
+#define VMALLOC_LAZY_MAX  8192   // Pages (32 MB), danach wird geflusht
+
+// Fenster als freien Bereich anlegen (nach heap_init)
+void vmalloc_init(void);
+
+// size Bytes (auf Pages gerundet) mit eigenen Frames mappen
+void* vmalloc(uint64_t size);
+void vfree(void* addr);
+
+// Vorhandene Frames zusammenhängend mappen (jeder Frame bekommt eine Referenz)
+void* vmap(void* const* frames, uint64_t count, uint32_t flags);
+void vunmap(void* addr);
+
+/*
+ * Nur Adressbereich reservieren (ausgerichtet auf align), gemappt wird vom
+ * Aufrufer. Vor free_vm_area muss er alles wieder per vmm_unmap_range
+ * entfernt haben.
+ */
+void* get_vm_area(uint64_t size, uint64_t align);
+void free_vm_area(void* addr);
+
+/*
+ * MMIO bzw. Framebuffer (physische Adressen außerhalb des RAMs) in das
+ * vmalloc-Fenster mappen. ioremap: uncached (UC), für Register mit
+ * Seiteneffekten. ioremap_wc: Write-Combining, Schreibzugriffe werden in
+ * Puffern gesammelt und als Bursts geschrieben (Framebuffer, Doorbells).
+ * Große, passend ausgerichtete Bereiche bekommen 2 MB Leaves.
+ * Nicht für RAM verwenden - die Direct Map hat ihn schon als WB gemappt.
+ */
+void* ioremap(uint64_t phys, uint64_t size);
+void* ioremap_wc(uint64_t phys, uint64_t size);
+void iounmap(void* addr);
+
+// Ausstehende vfree-Flushes sofort ausführen
+void vmalloc_purge(void);
+
+// Statistik: belegte Bereiche / Pages, auf den Flush wartende Pages, Purges
+uint64_t vmalloc_areas(void);
+uint64_t vmalloc_used_pages(void);
+uint64_t vmalloc_lazy_pages(void);
+uint64_t vmalloc_purges(void);
@@ -6,168 +6,1300 @@
 #include "vmm.h"
 #include "pmm.h"
 #include "vga.h"
+#include "cpu.h"
+#include "memory_map.h"
+#include "syscall.h"
+#include "heap.h"
 
-// Aktuelles PML4 (von stage2 erstellt)
-static uint64_t current_pml4_phys;
+// phys -> virt Offset: 0 (Identity Map von stage2) bis die Direct Map steht
+uint64_t vmm_direct_map_offset = 0;
+
+// Zählt Parent-Entries, denen der Walk PAGE_USER nachgetragen hat (erfordert Flush)
+static uint64_t walk_upgrades = 0;
+
+// CPU kann 1 GB Leaves (gesetzt in vmm_init)
+static int gb_pages = 0;
+
+// PAT: MSR und Belegung (PA0..PA7, je ein Byte), siehe PAGE_WC
+#define MSR_PAT         0x277
+#define PAT_UC          0x00ULL
+#define PAT_WC          0x01ULL
+#define PAT_WT          0x04ULL
+#define PAT_WB          0x06ULL
+#define PAT_UC_MINUS    0x07ULL
+#define PAT_LAYOUT      (PAT_WB | (PAT_WT << 8) | (PAT_UC_MINUS << 16) | (PAT_UC << 24) | \
+                         (PAT_WC << 32) | (PAT_WT << 40) | (PAT_UC_MINUS << 48) | (PAT_UC << 56))
+static int pat_enabled = 0;
+
+// Adressraum des Kernels (PML4 von stage2) und alle weiteren Adressräume
+vmm_space_t vmm_kernel_space;
+static vmm_space_t* space_list = NULL;
+
+// PCID-Unterstützung und Wechsel-Statistik
+static int pcid_enabled = 0;
+static int global_enabled = 0;
+static uint64_t cr3_switches = 0;
+static uint64_t cr3_noflush_switches = 0;
+
+// Statistik: angelegte große Leaves (2 MB / 1 GB) und aufgeteilte Leaves
+static uint64_t huge_maps = 0;
+static uint64_t leaf_splits = 0;
+
+// Statistik: per Page Fault nachgeladene Pages, COW-Faults mit Kopie / ohne
+static uint64_t demand_faults = 0;
+static uint64_t cow_copies = 0;
+static uint64_t cow_reuses = 0;
+
+// Statistik: Page-Table Frames in Benutzung / leer gewordene und freigegebene
+static uint64_t pt_frames = 0;
+static uint64_t pt_reclaimed = 0;
+
+/*
+ * Ebenen: 1 = PT (4 KB Entries), 2 = PD (2 MB Leaves), 3 = PDPT (1 GB Leaves),
+ * 4 = PML4. Ein Entry auf Ebene n deckt VMM_LEVEL_SIZE(n) Bytes ab.
+ */
+#define VMM_LEVEL_SHIFT(level) (12 + 9 * ((level) - 1))
+#define VMM_LEVEL_SIZE(level)  (1ULL << VMM_LEVEL_SHIFT(level))
+
+// Helper: Neue Page-Table (vorab genullt aus dem Zero-Pool) alloziieren und markieren
+static uint64_t vmm_alloc_table(void) {
+    void* table = pmm_alloc_zeroed_page();
+    if (table) {
+        page_t* page = pmm_phys_to_page((uint64_t)table);
+        page->flags |= PG_PAGETABLE;
+        page->pt_entries = 0;
+        pt_frames++;
+    }
+    return (uint64_t)table;
+}
+
+// Helper: page_t der Tabelle, in der entry liegt (NULL bei Tabellen aus stage2)
+static page_t* vmm_table_page(pte_t* entry) {
+    page_t* page = pmm_phys_to_page(virt_to_phys((void*)((uint64_t)entry & ~0xFFFULL)));
+    return (page && (page->flags & PG_PAGETABLE)) ? page : NULL;
+}
+
+/*
+ * Helper: Belegung der Tabelle, in der entry liegt, um delta ändern. Gezählt
+ * werden Entries, die present werden oder es nicht mehr sind; erreicht eine
+ * Tabelle 0, kann sie freigegeben werden (PML4s ausgenommen).
+ */
+static void vmm_table_count(pte_t* entry, int delta) {
+    page_t* page = vmm_table_page(entry);
+    if (page) {
+        page->pt_entries += delta;
+    }
+}
+
+// Helper: Liegt in [start, end) RAM laut E820 (nutzbar oder ACPI)?
+static int vmm_range_has_ram(uint64_t start, uint64_t end) {
+    uint16_t count = memory_map_entry_count();
+    memory_map_entry_t* entries = memory_map_entries();
+
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t type = entries[i].type;
+        if (type != 1 && type != 3 && type != 4) {
+            continue; // Reserviert/MMIO nicht cachebar mappen
+        }
+        if (entries[i].base < end && entries[i].base + entries[i].length > start) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Direct Map aufbauen: jeder RAM-Bereich liegt zusätzlich bei
+ * VMM_DIRECT_MAP_BASE + phys. Ganze GBs mit 1 GB Pages (falls die CPU
+ * das kann), sonst 2 MB Pages; 2 MB Blöcke ohne RAM bleiben ungemappt.
+ * Die Tabellen kommen aus dem PMM (< 1 GB, noch über die Identity Map).
+ */
+static void vmm_build_direct_map(void) {
+    uint16_t count = memory_map_entry_count();
+    memory_map_entry_t* entries = memory_map_entries();
+
+    uint64_t max_addr = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        uint64_t end = entries[i].base + entries[i].length;
+        if (entries[i].type == 1 && end > max_addr) {
+            max_addr = end;
+        }
+    }
+
+    pte_t* pml4 = (pte_t*)phys_to_virt(vmm_kernel_space.pml4_phys);
+
+    for (uint64_t gb = 0; gb < max_addr; gb += VMM_1GB) {
+        if (!vmm_range_has_ram(gb, gb + VMM_1GB)) {
+            continue;
+        }
+
+        uint64_t virt = VMM_DIRECT_MAP_BASE + gb;
+        uint64_t pml4_idx = PML4_INDEX(virt);
+        if (!(pml4[pml4_idx] & PAGE_PRESENT)) {
+            uint64_t pdpt_phys = vmm_alloc_table();
+            if (!pdpt_phys) return;
+            pml4[pml4_idx] = pdpt_phys | PAGE_PRESENT | PAGE_WRITE;
+            vmm_table_count(&pml4[pml4_idx], 1);
+        }
+        pte_t* pdpt = (pte_t*)phys_to_virt(pml4[pml4_idx] & PTE_ADDR_MASK);
+
+        // Wie viele 2 MB Blöcke dieses GBs enthalten RAM?
+        uint32_t chunks = 0;
+        for (uint64_t off = 0; off < VMM_1GB; off += VMM_2MB) {
+            chunks += vmm_range_has_ram(gb + off, gb + off + VMM_2MB);
+        }
+
+        if (gb_pages && chunks == 512) {
+            pdpt[PDPT_INDEX(virt)] = gb | PAGE_PRESENT | PAGE_WRITE | PAGE_HUGE | PAGE_GLOBAL;
+            vmm_table_count(&pdpt[PDPT_INDEX(virt)], 1);
+            continue;
+        }
+
+        uint64_t pd_phys = vmm_alloc_table();
+        if (!pd_phys) return;
+        pte_t* pd = (pte_t*)phys_to_virt(pd_phys);
+        for (uint64_t off = 0; off < VMM_1GB; off += VMM_2MB) {
+            if (vmm_range_has_ram(gb + off, gb + off + VMM_2MB)) {
+                pd[PD_INDEX(off)] = (gb + off) | PAGE_PRESENT | PAGE_WRITE | PAGE_HUGE | PAGE_GLOBAL;
+                vmm_table_count(&pd[PD_INDEX(off)], 1);
+            }
+        }
+        pdpt[PDPT_INDEX(virt)] = pd_phys | PAGE_PRESENT | PAGE_WRITE;
+        vmm_table_count(&pdpt[PDPT_INDEX(virt)], 1);
+    }
+
+    __asm__ volatile("mfence" ::: "memory");
+
+    // Ab jetzt laufen alle Frame-Zugriffe über die Direct Map
+    vmm_direct_map_offset = VMM_DIRECT_MAP_BASE;
+}
+
+/*
+ * Helper: Neue ASID für space aus der Generation dieser CPU. Ist der Vorrat
+ * erschöpft, beginnt eine neue Generation: ein globaler Flush verwirft die
+ * TLB-Einträge aller PCIDs, alte ASIDs dürfen danach neu vergeben werden.
+ */
+static void vmm_asid_alloc(vmm_space_t* space) {
+    cpu_data_t* cpu = cpu_current();
+
+    if (cpu->asid_next > VMM_ASID_MAX) {
+        vmm_flush_tlb_global();
+
+        cpu->asid_generation++;
+        cpu->asid_next = 1;
+    }
+
+    space->asid = (uint16_t)cpu->asid_next++;
+    space->asid_generation = cpu->asid_generation;
+}
+
+// Helper: PCID einschalten, falls vorhanden (CR3[11:0] ist hier noch 0)
+static void vmm_pcid_init(void) {
+    cpu_data_t* cpu = cpu_current();
+    cpu->asid_generation = 1;
+    cpu->asid_next = 1;
+    cpu->active_space = (uint64_t)&vmm_kernel_space;
+
+    if (!cpu_has_pcid()) {
+        return;
+    }
+
+    cpu_write_cr4(cpu_read_cr4() | CPU_CR4_PCIDE);
+    pcid_enabled = 1;
+
+    // Kernel bekommt die erste ASID, bisherige Einträge (PCID 0) verwerfen
+    vmm_asid_alloc(&vmm_kernel_space);
+    vmm_set_cr3(vmm_kernel_space.pml4_phys | vmm_kernel_space.asid);
+}
+
+void vmm_switch_space(vmm_space_t* space) {
+    cpu_data_t* cpu = cpu_current();
+    if (cpu->active_space == (uint64_t)space) {
+        return; // Gleicher Adressraum: TLB bleibt komplett warm
+    }
+
+    uint64_t cr3 = space->pml4_phys;
+    if (pcid_enabled) {
+        if (space->asid_generation == cpu->asid_generation) {
+            // ASID noch gültig: Einträge vom letzten Lauf wiederverwenden
+            cr3 |= space->asid | CR3_NOFLUSH;
+            cr3_noflush_switches++;
+        } else {
+            // Frische ASID: ohne NOFLUSH, Reste eines Vorbesitzers verwerfen
+            vmm_asid_alloc(space);
+            cr3 |= space->asid;
+        }
+    }
+
+    vmm_set_cr3(cr3);
+    cpu->active_space = (uint64_t)space;
+    cr3_switches++;
+}
+
+void vmm_flush_tlb(void) {
+    // CR3 ohne NOFLUSH zurückschreiben: verwirft die nicht-globalen Einträge der aktuellen PCID
+    vmm_set_cr3(vmm_get_cr3());
+}
+
+void vmm_flush_tlb_global(void) {
+    // CR4.PGE umschalten verwirft alle Einträge aller PCIDs, auch globale
+    uint64_t cr4 = cpu_read_cr4();
+    cpu_write_cr4(cr4 ^ CPU_CR4_PGE);
+    cpu_write_cr4(cr4);
+}
+
+int vmm_global_enabled(void) {
+    return global_enabled;
+}
+
+int vmm_pcid_enabled(void) {
+    return pcid_enabled;
+}
+
+uint64_t vmm_cr3_switches(void) {
+    return cr3_switches;
+}
+
+uint64_t vmm_cr3_noflush_switches(void) {
+    return cr3_noflush_switches;
+}
 
 void vmm_init(void) {
     // Hole aktuelles CR3 (zeigt auf PML4 von Bootloader)
-    current_pml4_phys = vmm_get_cr3();
+    vmm_kernel_space.pml4_phys = vmm_get_cr3() & PTE_ADDR_MASK;
+    gb_pages = cpu_has_1gb_pages();
+
+    // Gesamten physischen Speicher in die höhere Hälfte mappen
+    vmm_build_direct_map();
+
+    // Write-Combining auf PAT Index 4 legen. Index 0-3 bleiben wie nach dem
+    // Reset, bestehende Mappings ändern also ihren Cache-Typ nicht. Das
+    // Setzen von CR4.PGE danach flusht den TLB.
+    if (cpu_has_pat()) {
+        wrmsr(MSR_PAT, PAT_LAYOUT);
+        pat_enabled = 1;
+    }
+
+    // Kernel-Mappings (G-Bit aus stage2 und VMM) beim CR3-Wechsel behalten
+    cpu_write_cr4(cpu_read_cr4() | CPU_CR4_PGE);
+    global_enabled = 1;
+
+    // Schreibschutz auch für Ring 0, sonst umgehen Kernel-Zugriffe auf
+    // User-Puffer das Copy-on-Write
+    cpu_write_cr0(cpu_read_cr0() | CPU_CR0_WP);
+
+    // TLB-Einträge pro Adressraum taggen
+    vmm_pcid_init();
 
     // VMM initialisiert - keine Ausgabe für sauberes Boot
 }
 
-// Helper: Hole Page Table Entry Pointer (erstellt Tables bei Bedarf)
-// flags werden an die Parent-Entries weitergegeben (für PAGE_USER)
-static pte_t* vmm_get_pte_flags(uint64_t virt_addr, int create, uint32_t flags) {
+/*
+ * Helper: Änderung an [start, end) in space sichtbar machen. Ist space gerade
+ * nicht geladen (und der Bereich nicht in der geteilten Kernel-Hälfte), reicht
+ * es, seine ASID zu verwerfen - beim nächsten Wechsel gibt es eine frische.
+ */
+static int vmm_space_needs_flush(vmm_space_t* space, uint64_t start) {
+    if (start >= VMM_KERNEL_BASE || cpu_current()->active_space == (uint64_t)space) {
+        return 1;
+    }
+    space->asid_generation = 0;
+    return 0;
+}
+
+/*
+ * Großes Leaf (Ebene 2 oder 3) durch eine Tabelle mit 512 Entries der
+ * nächstkleineren Größe ersetzen. Die Übersetzungen bleiben gleich. Die
+ * Frame-Referenz des Leafs gilt für den ganzen Block und kann keinem Kind
+ * allein gehören - sonst gäbe das Unmappen dieses Kinds den Block frei,
+ * während die übrigen noch hineinzeigen. Sie wandert deshalb auf die neue
+ * Tabelle (page_t owner = Block) und wird in vmm_free_table abgegeben,
+ * wenn das letzte Kind weg ist. Frame 0 gehört nie dem PMM, owner 0 heißt
+ * also "keine Referenz".
+ */
+static int vmm_split_leaf(vmm_space_t* space, pte_t* entry, int level, uint64_t virt_addr) {
+    uint64_t table_phys = vmm_alloc_table();
+    if (!table_phys) {
+        return 0;
+    }
+
+    pte_t old = *entry;
+    uint64_t child_size = VMM_LEVEL_SIZE(level - 1);
+    uint64_t base = old & PTE_ADDR_MASK & ~(VMM_LEVEL_SIZE(level) - 1);
+    uint64_t child_flags = (old & ~PTE_ADDR_MASK & ~PAGE_FRAME_REF) | (old & PAGE_PAT_LARGE);
+    if (level == 2) {
+        // 4 KB Entries haben kein PS-Bit, ihr PAT-Bit liegt an dessen Stelle
+        child_flags &= ~(PAGE_HUGE | PAGE_PAT_LARGE);
+        if (old & PAGE_PAT_LARGE) {
+            child_flags |= PAGE_PAT;
+        }
+    }
+
+    pte_t* table = (pte_t*)phys_to_virt(table_phys);
+    for (uint64_t i = 0; i < 512; i++) {
+        table[i] = (base + i * child_size) | child_flags;
+    }
+    page_t* table_page = pmm_phys_to_page(table_phys);
+    table_page->pt_entries = 512;
+    if (old & PAGE_FRAME_REF) {
+        table_page->owner = base;
+    }
+
+    // Tabelle übernimmt die Rechte des Leafs
+    *entry = table_phys | (old & (PAGE_PRESENT | PAGE_WRITE | PAGE_USER));
+
+    // Großen TLB-Eintrag verwerfen, sonst überdeckt er spätere 4 KB Änderungen
+    if (vmm_space_needs_flush(space, virt_addr)) {
+        vmm_invlpg(virt_addr);
+    }
+    leaf_splits++;
+    return 1;
+}
+
+/*
+ * Helper: Entry für virt_addr in space auf Ebene level holen.
+ * create: fehlende Tabellen anlegen und größere Leaves auf dem Weg aufteilen.
+ * Ohne create endet der Walk an einem großen Leaf, *leaf_level meldet die
+ * Ebene des zurückgegebenen Entries (bzw. des fehlenden, wenn 0 kommt).
+ * Die Kernel-Hälfte wird immer über das Kernel-PML4 gewalkt; neue PML4
+ * Entries dort werden in alle Adressräume übernommen.
+ * flags werden an die Parent-Entries weitergegeben (für PAGE_USER)
+ *
+ * Keine Barrieren nötig: x86 schreibt in Programmreihenfolge (TSO), die neue
+ * Tabelle ist also genullt, bevor der Parent-Entry sichtbar wird.
+ */
+static pte_t* vmm_walk(vmm_space_t* space, uint64_t virt_addr, int level, int create,
+                       uint32_t flags, int* leaf_level) {
     // Parent flags: PAGE_USER muss in alle Levels propagiert werden!
     uint64_t parent_flags = PAGE_PRESENT | PAGE_WRITE;
     if (flags & PAGE_USER) {
         parent_flags |= PAGE_USER;
     }
 
-    // PML4 Entry
-    pte_t* pml4 = (pte_t*)current_pml4_phys;
-    uint64_t pml4_idx = PML4_INDEX(virt_addr);
+    int kernel_half = virt_addr >= VMM_KERNEL_BASE;
+    pte_t* table = (pte_t*)phys_to_virt(kernel_half ? vmm_kernel_space.pml4_phys : space->pml4_phys);
 
-    if (!(pml4[pml4_idx] & PAGE_PRESENT)) {
-        if (!create) return 0;
+    for (int lvl = 4; lvl > level; lvl--) {
+        uint64_t idx = (virt_addr >> VMM_LEVEL_SHIFT(lvl)) & 0x1FF;
+        pte_t* entry = &table[idx];
 
-        // Alloziere neue PDPT
-        uint64_t pdpt_phys = (uint64_t)pmm_alloc_page();
-        if (!pdpt_phys) return 0;
+        if (!(*entry & PAGE_PRESENT)) {
+            if (!create) {
+                if (leaf_level) *leaf_level = lvl;
+                return 0;
+            }
 
-        // PDPT mit Nullen initialisieren
-        pte_t* pdpt = (pte_t*)pdpt_phys;
-        for (int i = 0; i < 512; i++) {
-            pdpt[i] = 0;
-        }
+            // Alloziere nächste Table-Ebene
+            uint64_t next_phys = vmm_alloc_table();
+            if (!next_phys) return 0;
+
+            // Entry setzen MIT parent_flags (inkl. PAGE_USER wenn nötig)
+            *entry = next_phys | parent_flags;
+            vmm_table_count(entry, 1);
 
-        // Memory Barrier: Sicherstellen dass alle Writes abgeschlossen sind
-        __asm__ volatile("mfence" ::: "memory");
+            // Neue PDPT der Kernel-Hälfte: alle Adressräume sollen sie sehen
+            if (lvl == 4 && kernel_half) {
+                for (vmm_space_t* s = space_list; s; s = s->next) {
+                    ((pte_t*)phys_to_virt(s->pml4_phys))[idx] = *entry;
+                }
+            }
+        } else if (*entry & PAGE_HUGE) {
+            // Großes Leaf oberhalb der gewünschten Ebene
+            if (!create) {
+                if (leaf_level) *leaf_level = lvl;
+                return entry;
+            }
+            if (!vmm_split_leaf(space, entry, lvl, virt_addr)) return 0;
+        }
 
-        // PML4 Entry setzen MIT parent_flags (inkl. PAGE_USER wenn nötig)
-        pml4[pml4_idx] = pdpt_phys | parent_flags;
+        if ((flags & PAGE_USER) && !(*entry & PAGE_USER)) {
+            // Entry existiert aber hat kein USER bit - hinzufügen!
+            *entry |= PAGE_USER;
+            walk_upgrades++;
+        }
 
-        // Memory Barrier nach Parent Entry Write
-        __asm__ volatile("mfence" ::: "memory");
-    } else if ((flags & PAGE_USER) && !(pml4[pml4_idx] & PAGE_USER)) {
-        // Entry existiert aber hat kein USER bit - hinzufügen!
-        pml4[pml4_idx] |= PAGE_USER;
-        __asm__ volatile("mfence" ::: "memory");
+        table = (pte_t*)phys_to_virt(*entry & PTE_ADDR_MASK);
     }
 
-    // PDPT Entry
-    pte_t* pdpt = (pte_t*)(pml4[pml4_idx] & ~0xFFF);
-    uint64_t pdpt_idx = PDPT_INDEX(virt_addr);
+    if (leaf_level) *leaf_level = level;
+    return &table[(virt_addr >> VMM_LEVEL_SHIFT(level)) & 0x1FF];
+}
 
-    if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-        if (!create) return 0;
+// Helper: 4 KB Entry holen (0, wenn die Adresse in einem großen Leaf liegt)
+static pte_t* vmm_get_pte(vmm_space_t* space, uint64_t virt_addr, int create) {
+    int level;
+    pte_t* pte = vmm_walk(space, virt_addr, 1, create, 0, &level);
+    return level == 1 ? pte : 0;
+}
 
-        // Alloziere neue PD
-        uint64_t pd_phys = (uint64_t)pmm_alloc_page();
-        if (!pd_phys) return 0;
+// Helper: Leere Tabelle (Ebene level) samt Untertabellen an den PMM zurückgeben
+static void vmm_free_table(uint64_t table_phys, int level) {
+    page_t* page = pmm_phys_to_page(table_phys);
+    if (!page || !(page->flags & PG_PAGETABLE)) {
+        return;  // Tabellen aus stage2 gehören nicht dem PMM
+    }
 
-        // PD mit Nullen initialisieren
-        pte_t* pd = (pte_t*)pd_phys;
+    if (level > 1) {
+        pte_t* table = (pte_t*)phys_to_virt(table_phys);
         for (int i = 0; i < 512; i++) {
-            pd[i] = 0;
+            if ((table[i] & PAGE_PRESENT) && !(table[i] & PAGE_HUGE)) {
+                vmm_free_table(table[i] & PTE_ADDR_MASK, level - 1);
+            }
         }
+    }
 
-        // Memory Barrier
-        __asm__ volatile("mfence" ::: "memory");
+    // Referenz des aufgeteilten Leafs fällt erst mit dem letzten Kind
+    if (page->owner) {
+        pmm_page_unmap((void*)page->owner);
+        page->owner = 0;
+    }
 
-        // PDPT Entry setzen MIT parent_flags
-        pdpt[pdpt_idx] = pd_phys | parent_flags;
+    page->flags &= ~PG_PAGETABLE;
+    pmm_free_page((void*)table_phys);
+    pt_frames--;
+}
 
-        // Memory Barrier
-        __asm__ volatile("mfence" ::: "memory");
-    } else if ((flags & PAGE_USER) && !(pdpt[pdpt_idx] & PAGE_USER)) {
-        // Entry existiert aber hat kein USER bit - hinzufügen!
-        pdpt[pdpt_idx] |= PAGE_USER;
-        __asm__ volatile("mfence" ::: "memory");
+/*
+ * TLB Batching: abgebaute oder ersetzte Mappings werden gesammelt, am Ende
+ * einmal geflusht und erst danach die Frames freigegeben - sonst könnte ein
+ * veralteter TLB-Eintrag noch auf einen schon wiederverwendeten Frame zeigen.
+ * Neue Mappings (vorher nicht present) brauchen keinen Flush, die CPU cached
+ * keine nicht-präsenten Übersetzungen.
+ * Leer gewordene Page Tables warten genauso: die CPU kann Verweise auf sie
+ * noch in ihren Paging-Structure Caches halten.
+ */
+typedef struct {
+    vmm_space_t* space;               // Adressraum der Änderungen
+    uint64_t start;                   // Zu flushender Bereich [start, end)
+    uint64_t end;
+    uint32_t count;                   // Gesammelte Frames
+    uint32_t table_count;             // Ausgehängte Tabellen
+    int global;                       // Globale Einträge dabei (CR3-Reload reicht nicht)
+    int kernel_tables;                // Kernel-Tabellen dabei (alle PCIDs flushen)
+    int lazy;                         // Kein Flush, der Aufrufer flusht gesammelt
+    uint64_t frames[VMM_GATHER_MAX];
+    uint64_t tables[VMM_GATHER_MAX];  // Physische Adresse | Ebene
+} vmm_gather_t;
+
+static uint64_t tlb_full_flushes = 0;
+static uint64_t tlb_page_flushes = 0;
+
+// Helper: TLB für [start, end) invalidieren, über der Schwelle komplett
+// (invlpg trifft auch globale Einträge, ein CR3-Reload nicht)
+static void vmm_flush_range(uint64_t start, uint64_t end, int global) {
+    uint64_t pages = (end - start) / PAGE_SIZE;
+
+    if (pages > VMM_FLUSH_THRESHOLD) {
+        if (global) {
+            vmm_flush_tlb_global();
+        } else {
+            vmm_flush_tlb();
+        }
+        tlb_full_flushes++;
+        return;
     }
 
-    // PD Entry
-    pte_t* pd = (pte_t*)(pdpt[pdpt_idx] & ~0xFFF);
-    uint64_t pd_idx = PD_INDEX(virt_addr);
+    for (uint64_t virt = start; virt < end; virt += PAGE_SIZE) {
+        vmm_invlpg(virt);
+    }
+    tlb_page_flushes += pages;
+}
 
-    if (!(pd[pd_idx] & PAGE_PRESENT)) {
-        if (!create) return 0;
+// Helper: Flush ausführen, dann die Referenzen der alten Mappings abgeben
+static void vmm_gather_flush(vmm_gather_t* gather) {
+    if (gather->lazy) {
+        // Frames hält der Aufrufer noch selbst, bis er den Flush nachholt
+    } else if (gather->kernel_tables) {
+        // invlpg erreicht nur die Paging-Structure Caches der aktuellen PCID
+        vmm_flush_tlb_global();
+        tlb_full_flushes++;
+    } else if (gather->start < gather->end && vmm_space_needs_flush(gather->space, gather->start)) {
+        vmm_flush_range(gather->start, gather->end, gather->global);
+    }
 
-        // Alloziere neue PT
-        uint64_t pt_phys = (uint64_t)pmm_alloc_page();
-        if (!pt_phys) return 0;
+    for (uint32_t i = 0; i < gather->count; i++) {
+        pmm_page_unmap((void*)gather->frames[i]);
+    }
+    for (uint32_t i = 0; i < gather->table_count; i++) {
+        vmm_free_table(gather->tables[i] & PTE_ADDR_MASK, gather->tables[i] & 0xFFF);
+    }
 
-        // PT mit Nullen initialisieren
-        pte_t* pt = (pte_t*)pt_phys;
-        for (int i = 0; i < 512; i++) {
-            pt[i] = 0;
+    gather->start = gather->end = 0;
+    gather->count = 0;
+    gather->table_count = 0;
+    gather->global = 0;
+    gather->kernel_tables = 0;
+}
+
+// Helper: Ausgehängte Tabelle (Ebene level, für virt_addr zuständig) nach dem Flush freigeben
+static void vmm_gather_table(vmm_gather_t* gather, uint64_t virt_addr, uint64_t table_phys, int level) {
+    if (gather->table_count == VMM_GATHER_MAX) {
+        vmm_gather_flush(gather);
+    }
+
+    if (gather->start == gather->end) {
+        gather->start = virt_addr & ~0xFFFULL;
+        gather->end = gather->start + PAGE_SIZE;
+    }
+    if (virt_addr >= VMM_KERNEL_BASE) {
+        gather->kernel_tables = 1;
+    }
+    gather->tables[gather->table_count++] = table_phys | level;
+    pt_reclaimed++;
+}
+
+/*
+ * Helper: Ab der Tabelle auf Ebene level (zuständig für virt_addr) leer
+ * gewordene Tabellen aushängen, solange auch die nächsthöhere leer wird.
+ * PML4s bleiben, ebenso die PDPTs der Kernel-Hälfte (in jedem Adressraum
+ * eingehängt).
+ */
+static void vmm_reclaim_tables(vmm_gather_t* gather, uint64_t virt_addr, int level) {
+    if (gather->lazy) {
+        return;  // Ohne Flush könnten die Tabellen noch gecacht sein
+    }
+
+    for (; level < 4; level++) {
+        if (level == 3 && virt_addr >= VMM_KERNEL_BASE) {
+            return;
         }
 
-        // Memory Barrier
-        __asm__ volatile("mfence" ::: "memory");
+        int found;
+        pte_t* parent = vmm_walk(gather->space, virt_addr, level + 1, 0, 0, &found);
+        if (!parent || found != level + 1 || !(*parent & PAGE_PRESENT) || (*parent & PAGE_HUGE)) {
+            return;
+        }
 
-        // PD Entry setzen MIT parent_flags
-        pd[pd_idx] = pt_phys | parent_flags;
+        uint64_t table_phys = *parent & PTE_ADDR_MASK;
+        page_t* page = pmm_phys_to_page(table_phys);
+        if (!page || !(page->flags & PG_PAGETABLE) || page->pt_entries) {
+            return;
+        }
 
-        // Memory Barrier
-        __asm__ volatile("mfence" ::: "memory");
-    } else if ((flags & PAGE_USER) && !(pd[pd_idx] & PAGE_USER)) {
-        // Entry existiert aber hat kein USER bit - hinzufügen!
-        pd[pd_idx] |= PAGE_USER;
-        __asm__ volatile("mfence" ::: "memory");
+        *parent = 0;
+        vmm_table_count(parent, -1);
+        vmm_gather_table(gather, virt_addr, table_phys, level);
     }
+}
 
-    // PT Entry
-    pte_t* pt = (pte_t*)(pd[pd_idx] & ~0xFFF);
-    uint64_t pt_idx = PT_INDEX(virt_addr);
+// Helper: Entfernten Entry (deckt size Bytes ab virt_addr) merken
+static void vmm_gather_add(vmm_gather_t* gather, uint64_t virt_addr, uint64_t size, pte_t old) {
+    if (gather->count == VMM_GATHER_MAX) {
+        vmm_gather_flush(gather);
+    }
 
-    return &pt[pt_idx];
+    if (gather->start == gather->end) {
+        gather->start = virt_addr;
+    }
+    gather->end = virt_addr + size;
+    if (old & PAGE_GLOBAL) {
+        gather->global = 1;
+    }
+
+    // Nur Mappings, die beim Anlegen eine Referenz genommen haben, geben eine ab
+    if (old & PAGE_FRAME_REF) {
+        uint64_t phys = old & PTE_ADDR_MASK & ~(size - 1);
+        gather->frames[gather->count++] = phys;
+    }
 }
 
-// Wrapper für Rückwärtskompatibilität (ohne flags)
-static pte_t* vmm_get_pte(uint64_t virt_addr, int create) {
-    return vmm_get_pte_flags(virt_addr, create, 0);
+// Helper: Cache-Modus aus flags (PAGE_WC) in die PAT-Bits eines Leafs auf Ebene level übersetzen
+static uint32_t vmm_cache_flags(uint32_t flags, int level) {
+    if (!(flags & PAGE_WC)) {
+        return flags;
+    }
+
+    flags &= ~(PAGE_WC | PAGE_NOCACHE | PAGE_WRITETHROUGH);
+    if (!pat_enabled) {
+        return flags | PAGE_NOCACHE;
+    }
+    return flags | (level == 1 ? PAGE_PAT : PAGE_PAT_LARGE);
+}
+
+// Helper: Größte Leaf-Ebene, die an virt/phys ausgerichtet in size passt
+static int vmm_leaf_level(uint64_t virt_addr, uint64_t phys_addr, uint64_t size) {
+    if (gb_pages && !((virt_addr | phys_addr) & (VMM_1GB - 1)) && size >= VMM_1GB) {
+        return 3;
+    }
+    if (!((virt_addr | phys_addr) & (VMM_2MB - 1)) && size >= VMM_2MB) {
+        return 2;
+    }
+    return 1;
+}
+
+/*
+ * Helper: Großes Leaf in entry (Ebene level) eintragen. Hängt dort noch eine
+ * Tabelle, werden ihre Mappings abgebaut und die Tabellen freigegeben.
+ */
+static int vmm_set_leaf(vmm_gather_t* gather, pte_t* entry, int level,
+                        uint64_t virt_addr, uint64_t phys_addr, uint32_t flags) {
+    vmm_space_t* space = gather->space;
+    uint64_t size = VMM_LEVEL_SIZE(level);
+    pte_t old = *entry;
+
+    // Meist hängt unmap_range die leer gewordene Tabelle schon selbst aus,
+    // evtl. auch die Tabelle mit entry -> neu suchen
+    if ((old & PAGE_PRESENT) && !(old & PAGE_HUGE)) {
+        vmm_unmap_range(space, virt_addr, size);
+        entry = vmm_walk(space, virt_addr, level, 1, flags, NULL);
+        if (!entry) {
+            return 0;
+        }
+        old = *entry;
+    }
+
+    pmm_page_map((void*)phys_addr);
+    *entry = phys_addr | flags | PAGE_PRESENT | PAGE_HUGE | PAGE_FRAME_REF;
+    huge_maps++;
+
+    if (!(old & PAGE_PRESENT)) {
+        vmm_table_count(entry, 1);
+    } else if (old & PAGE_HUGE) {
+        vmm_gather_add(gather, virt_addr, size, old);
+    } else {
+        // Übrig gebliebene Tabelle erst nach dem Flush freigeben
+        vmm_gather_table(gather, virt_addr, old & PTE_ADDR_MASK, level - 1);
+    }
+    return 1;
 }
 
-void vmm_map_page(uint64_t virt_addr, uint64_t phys_addr, uint32_t flags) {
-    // Hier MUSS flags übergeben werden, damit pte_get_flags das USER-Bit sieht!
-    pte_t* pte = vmm_get_pte_flags(virt_addr, 1, flags);
-    
-    if (!pte) {
+/*
+ * Gemeinsamer Kern von vmm_map_range/vmm_map_pages: der Table-Walk läuft nur
+ * einmal pro Page Table (2 MB), danach werden die PTEs fortlaufend gefüllt.
+ * frames != NULL: einzelne Frames, sonst zusammenhängend ab phys_addr - dann
+ * werden ausgerichtete Teile als 2 MB / 1 GB Leaves gemappt.
+ */
+static int vmm_map_batch(vmm_space_t* space, uint64_t virt_addr, uint64_t phys_addr,
+                         void* const* frames, uint64_t count, uint32_t flags) {
+    vmm_gather_t gather = { .space = space };
+    uint64_t upgrades = walk_upgrades;
+    pte_t* pte = NULL;
+    page_t* pt_page = NULL;
+    uint64_t i = 0;
+
+    flags &= ~(PAGE_HUGE | PAGE_FRAME_REF | PAGE_PAT_LARGE);
+
+    // Kernel-Mappings sehen in jedem Adressraum gleich aus -> global
+    if (!(flags & PAGE_USER) && virt_addr >= VMM_KERNEL_BASE) {
+        flags |= PAGE_GLOBAL;
+    }
+    uint32_t pte_flags = vmm_cache_flags(flags, 1);
+
+    while (i < count) {
+        uint64_t virt = virt_addr + i * PAGE_SIZE;
+        uint64_t phys = frames ? (uint64_t)frames[i] : phys_addr + i * PAGE_SIZE;
+        phys &= PTE_ADDR_MASK;
+
+        int level = frames ? 1 : vmm_leaf_level(virt, phys, (count - i) * PAGE_SIZE);
+        if (level > 1) {
+            pte_t* entry = vmm_walk(space, virt, level, 1, flags, NULL);
+            if (!entry || !vmm_set_leaf(&gather, entry, level, virt, phys, vmm_cache_flags(flags, level))) {
+                break;
+            }
+            i += VMM_LEVEL_SIZE(level) / PAGE_SIZE;
+            pte = NULL;
+            continue;
+        }
+
+        // Neue Page Table nur am Anfang und an jeder 2 MB Grenze suchen
+        if (!pte || PT_INDEX(virt) == 0) {
+            pte = vmm_walk(space, virt, 1, 1, flags, NULL);
+            if (!pte) {
+                break;
+            }
+            pt_page = vmm_table_page(pte);
+        }
+
+        // Mapping hält eine Referenz auf den Frame, ein ersetztes gibt seine ab
+        pte_t old = *pte;
+        pmm_page_map((void*)phys);
+        *pte++ = phys | pte_flags | PAGE_PRESENT | PAGE_FRAME_REF;
+
+        if (old & PAGE_PRESENT) {
+            vmm_gather_add(&gather, virt, PAGE_SIZE, old);
+        } else if (pt_page) {
+            pt_page->pt_entries++;
+        }
+        i++;
+    }
+
+    // Erweiterte Rechte in den Parent-Entries: ganzen Bereich neu übersetzen lassen
+    if (walk_upgrades != upgrades) {
+        gather.start = virt_addr;
+        gather.end = virt_addr + i * PAGE_SIZE;
+    }
+    vmm_gather_flush(&gather);
+
+    if (i < count) {
+        // Kein Speicher für Page Tables: bereits gemappte Pages wieder entfernen
         vga_println("[VMM] ERROR: Failed to get PTE!");
-        return;
+        vmm_unmap_range(space, virt_addr, i * PAGE_SIZE);
+        return 0;
     }
+    return 1;
+}
 
-    *pte = (phys_addr & ~0xFFF) | flags | PAGE_PRESENT;
+int vmm_map_range(vmm_space_t* space, uint64_t virt_addr, uint64_t phys_addr,
+                  uint64_t size, uint32_t flags) {
+    uint64_t count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    return vmm_map_batch(space, virt_addr & ~0xFFFULL, phys_addr, NULL, count, flags);
+}
 
-    __asm__ volatile("mfence" ::: "memory");
-    vmm_invlpg(virt_addr);
+int vmm_map_pages(vmm_space_t* space, uint64_t virt_addr, void* const* frames,
+                  uint64_t count, uint32_t flags) {
+    return vmm_map_batch(space, virt_addr & ~0xFFFULL, 0, frames, count, flags);
 }
 
-void vmm_unmap_page(uint64_t virt_addr) {
-    pte_t* pte = vmm_get_pte(virt_addr, 0);
-    if (!pte || !(*pte & PAGE_PRESENT)) {
-        return; // Nicht gemapped
+// Helper: Mappings in [virt_addr, virt_addr + size) entfernen und in gather sammeln
+static void vmm_unmap_gather(vmm_gather_t* gather, uint64_t virt_addr, uint64_t size) {
+    vmm_space_t* space = gather->space;
+    uint64_t virt = virt_addr & ~0xFFFULL;
+    uint64_t end = virt_addr + size;
+
+    while (virt < end) {
+        int level;
+        pte_t* pte = vmm_walk(space, virt, 1, 0, 0, &level);
+
+        if (!pte) {
+            // Fehlende Tabelle: ganzen Bereich dieses Entries überspringen
+            virt = (virt & ~(VMM_LEVEL_SIZE(level) - 1)) + VMM_LEVEL_SIZE(level);
+            continue;
+        }
+
+        if (level > 1) {
+            uint64_t leaf_size = VMM_LEVEL_SIZE(level);
+
+            // Ganz abgedecktes Leaf entfernen, angeschnittenes erst aufteilen
+            if (!(virt & (leaf_size - 1)) && end - virt >= leaf_size) {
+                pte_t old = *pte;
+                *pte = 0;
+                vmm_table_count(pte, -1);
+                vmm_gather_add(gather, virt, leaf_size, old);
+                vmm_reclaim_tables(gather, virt, level);
+                virt += leaf_size;
+            } else if (!vmm_split_leaf(space, pte, level, virt)) {
+                vga_println("[VMM] ERROR: Failed to split large page!");
+                virt = (virt & ~(leaf_size - 1)) + leaf_size;
+            }
+            continue;
+        }
+
+        // Rest dieser Page Table ohne erneuten Walk abarbeiten
+        uint64_t pt_virt = virt;
+        uint64_t pt_end = (virt & ~(VMM_2MB - 1)) + VMM_2MB;
+        page_t* pt_page = vmm_table_page(pte);
+        for (; virt < end && virt < pt_end; virt += PAGE_SIZE, pte++) {
+            if (*pte & PAGE_PRESENT) {
+                pte_t old = *pte;
+                *pte = 0;
+                if (pt_page) {
+                    pt_page->pt_entries--;
+                }
+                vmm_gather_add(gather, virt, PAGE_SIZE, old);
+            }
+        }
+
+        // Page Table leer geworden: samt leer gewordener Eltern aushängen
+        if (pt_page && !pt_page->pt_entries) {
+            vmm_reclaim_tables(gather, pt_virt, 1);
+        }
     }
 
-    // Entry löschen
-    *pte = 0;
+    vmm_gather_flush(gather);
+}
 
-    // Memory Barrier
-    __asm__ volatile("mfence" ::: "memory");
+void vmm_unmap_range(vmm_space_t* space, uint64_t virt_addr, uint64_t size) {
+    vmm_gather_t gather = { .space = space };
+    vmm_unmap_gather(&gather, virt_addr, size);
+}
+
+void vmm_unmap_range_lazy(vmm_space_t* space, uint64_t virt_addr, uint64_t size) {
+    vmm_gather_t gather = { .space = space, .lazy = 1 };
+    vmm_unmap_gather(&gather, virt_addr, size);
+}
+
+void vmm_map_page(vmm_space_t* space, uint64_t virt_addr, uint64_t phys_addr, uint32_t flags) {
+    vmm_map_batch(space, virt_addr & ~0xFFFULL, phys_addr, NULL, 1, flags);
+}
+
+void vmm_unmap_page(vmm_space_t* space, uint64_t virt_addr) {
+    vmm_unmap_range(space, virt_addr, PAGE_SIZE);
+}
+
+uint64_t vmm_tlb_full_flushes(void) {
+    return tlb_full_flushes;
+}
 
-    // TLB invalidieren
-    vmm_invlpg(virt_addr);
+uint64_t vmm_tlb_page_flushes(void) {
+    return tlb_page_flushes;
 }
 
-uint64_t vmm_virt_to_phys(uint64_t virt_addr) {
-    pte_t* pte = vmm_get_pte(virt_addr, 0);
+uint64_t vmm_huge_maps(void) {
+    return huge_maps;
+}
+
+uint64_t vmm_leaf_splits(void) {
+    return leaf_splits;
+}
+
+uint64_t vmm_pt_frames(void) {
+    return pt_frames;
+}
+
+uint64_t vmm_pt_reclaimed(void) {
+    return pt_reclaimed;
+}
+
+int vmm_pat_enabled(void) {
+    return pat_enabled;
+}
+
+int vmm_has_1gb_pages(void) {
+    return gb_pages;
+}
+
+uint64_t vmm_virt_to_phys(vmm_space_t* space, uint64_t virt_addr) {
+    int level;
+    pte_t* pte = vmm_walk(space, virt_addr, 1, 0, 0, &level);
     if (!pte || !(*pte & PAGE_PRESENT)) {
         return 0; // Nicht gemapped
     }
 
-    // Physical Address aus Entry
-    return (*pte & ~0xFFF) | (virt_addr & 0xFFF);
+    // Physical Address aus Entry, bei großen Leaves mit größerem Offset
+    uint64_t size = VMM_LEVEL_SIZE(level);
+    return (*pte & PTE_ADDR_MASK & ~(size - 1)) | (virt_addr & (size - 1));
+}
+
+int vmm_migrate_page(uint64_t pml4_phys, uint64_t virt_addr, uint64_t old_phys, uint64_t new_phys) {
+    // Heap-Pages gehören dem Kernel, User-Pages dem Adressraum ihres Faults
+    vmm_space_t* space = &vmm_kernel_space;
+    if (virt_addr < VMM_KERNEL_BASE && pml4_phys != vmm_kernel_space.pml4_phys) {
+        space = space_list;
+        while (space && space->pml4_phys != pml4_phys) {
+            space = space->next;
+        }
+        if (!space) {
+            return 0; // Adressraum gibt es nicht mehr
+        }
+    }
+
+    pte_t* pte = vmm_get_pte(space, virt_addr, 0);
+    if (!pte || !(*pte & PAGE_PRESENT) || (*pte & PTE_ADDR_MASK) != old_phys) {
+        return 0; // Nicht (mehr) auf old_phys gemapped
+    }
+
+    // Nur die Adresse tauschen, Flags bleiben erhalten
+    *pte = new_phys | (*pte & ~PTE_ADDR_MASK);
+
+    if (vmm_space_needs_flush(space, virt_addr)) {
+        vmm_invlpg(virt_addr);
+    }
+    return 1;
+}
+
+vmm_space_t* vmm_space_create(void) {
+    vmm_space_t* space = (vmm_space_t*)kmalloc(sizeof(vmm_space_t));
+    if (!space) {
+        return NULL;
+    }
+
+    uint64_t pml4_phys = vmm_alloc_table();
+    uint64_t pdpt_phys = pml4_phys ? vmm_alloc_table() : 0;
+    if (!pdpt_phys) {
+        if (pml4_phys) {
+            vmm_free_table(pml4_phys, 1);
+        }
+        kfree(space);
+        return NULL;
+    }
+
+    pte_t* kernel_pml4 = (pte_t*)phys_to_virt(vmm_kernel_space.pml4_phys);
+    pte_t* pml4 = (pte_t*)phys_to_virt(pml4_phys);
+
+    // Kernel-Hälfte per Referenz teilen: dieselben PDPTs wie im Kernel-PML4
+    for (int i = 256; i < 512; i++) {
+        pml4[i] = kernel_pml4[i];
+    }
+
+    // Erstes GB (Identity Map mit Kernel-Image, Boot-Stack, VGA) ebenfalls
+    // teilen, der User-Bereich ab VMM_USER_BASE bekommt eine eigene PDPT
+    pte_t* pdpt = (pte_t*)phys_to_virt(pdpt_phys);
+    pdpt[0] = ((pte_t*)phys_to_virt(kernel_pml4[0] & PTE_ADDR_MASK))[0];
+    pml4[0] = pdpt_phys | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    vmm_table_count(&pdpt[0], 1);
+
+    space->pml4_phys = pml4_phys;
+    space->asid = 0;
+    space->asid_generation = 0;   // Noch keine ASID
+    space->vmas = NULL;
+    space->next = space_list;
+    space_list = space;
+    return space;
+}
+
+void vmm_space_destroy(vmm_space_t* space) {
+    if (!space || space == &vmm_kernel_space) {
+        return;
+    }
+
+    // Nicht unter den eigenen Füßen abbauen
+    if (cpu_current()->active_space == (uint64_t)space) {
+        vmm_switch_space(&vmm_kernel_space);
+    }
+
+    // User-Mappings abbauen (gibt ihre Frame-Referenzen ab)
+    vmm_unmap_range(space, VMM_USER_BASE, VMM_USER_END - VMM_USER_BASE);
+    while (space->vmas) {
+        vmm_vma_t* vma = space->vmas;
+        space->vmas = vma->next;
+        kfree(vma);
+    }
+
+    // Eigene Tabellen der unteren Hälfte freigeben, die geteilte Identity-PD bleibt
+    pte_t* pml4 = (pte_t*)phys_to_virt(space->pml4_phys);
+    ((pte_t*)phys_to_virt(pml4[0] & PTE_ADDR_MASK))[0] = 0;
+    for (int i = 0; i < 256; i++) {
+        if (pml4[i] & PAGE_PRESENT) {
+            vmm_free_table(pml4[i] & PTE_ADDR_MASK, 3);
+        }
+    }
+    vmm_free_table(space->pml4_phys, 1);
+
+    // Aus der Liste austragen
+    for (vmm_space_t** link = &space_list; *link; link = &(*link)->next) {
+        if (*link == space) {
+            *link = space->next;
+            break;
+        }
+    }
+    kfree(space);
+}
+
+vmm_space_t* vmm_current_space(void) {
+    return (vmm_space_t*)cpu_current()->active_space;
+}
+
+/*
+ * Demand Paging
+ */
+
+vmm_vma_t* vmm_find_vma(vmm_space_t* space, uint64_t addr) {
+    for (vmm_vma_t* vma = space->vmas; vma && vma->start <= addr; vma = vma->next) {
+        if (addr < vma->end) {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+int vmm_vma_insert(vmm_space_t* space, vmm_vma_t* vma) {
+    if (vma->start >= vma->end || (vma->start & 0xFFF) || (vma->end & 0xFFF)) {
+        return 0;
+    }
+
+    // Sortiert einhängen, Überschneidungen ablehnen
+    vmm_vma_t** link = &space->vmas;
+    while (*link && (*link)->end <= vma->start) {
+        link = &(*link)->next;
+    }
+    if (*link && (*link)->start < vma->end) {
+        return 0;
+    }
+    vma->next = *link;
+    *link = vma;
+    return 1;
+}
+
+int vmm_reserve(vmm_space_t* space, uint64_t start, uint64_t size, uint32_t flags) {
+    vmm_vma_t* vma = (vmm_vma_t*)kmalloc(sizeof(vmm_vma_t));
+    if (!vma) {
+        return 0;
+    }
+
+    vma->start = start & ~0xFFFULL;
+    vma->end = (start + size + 0xFFF) & ~0xFFFULL;
+    vma->flags = flags | PAGE_PRESENT;
+    vma->movable = 0;
+    if (!vmm_vma_insert(space, vma)) {
+        kfree(vma);
+        return 0;
+    }
+    return 1;
+}
+
+void vmm_release(vmm_space_t* space, uint64_t start) {
+    for (vmm_vma_t** link = &space->vmas; *link; link = &(*link)->next) {
+        vmm_vma_t* vma = *link;
+        if (vma->start != start) {
+            continue;
+        }
+
+        // Verschiebbare Frames halten zusätzlich ihre Allokations-Referenz
+        if (vma->movable) {
+            for (uint64_t virt = vma->start; virt < vma->end; virt += PAGE_SIZE) {
+                uint64_t phys = vmm_virt_to_phys(space, virt);
+                if (phys) {
+                    pmm_free_page((void*)phys);
+                }
+            }
+        }
+        vmm_unmap_range(space, vma->start, vma->end - vma->start);
+
+        *link = vma->next;
+        kfree(vma);
+        return;
+    }
+}
+
+// Helper: Frame für page in vma allozieren und mappen
+static int vmm_fault_in(vmm_space_t* space, vmm_vma_t* vma, uint64_t page) {
+    // User-Pages kommen genullt, verschiebbare Kernel-Pages (Heap) aus Movable/CMA
+    void* frame = vma->movable ? pmm_alloc_movable_page() : pmm_alloc_zeroed_page();
+    if (!frame) {
+        return 0;
+    }
+    if (!vmm_map_pages(space, page, &frame, 1, vma->flags)) {
+        pmm_free_page(frame);
+        return 0;
+    }
+
+    if (vma->movable) {
+        // Allokations-Referenz bleibt, damit der PMM die Page verschieben darf
+        pmm_page_set_movable(frame, space->pml4_phys, page);
+    } else {
+        pmm_free_page(frame);   // Frame gehört jetzt dem Mapping
+        if (page < VMM_KERNEL_BASE) {
+            // User-Pages werden nur über ihr PTE erreicht, der PMM darf sie verschieben
+            pmm_page_set_movable(frame, space->pml4_phys, page);
+        }
+    }
+    demand_faults++;
+    return 1;
+}
+
+int vmm_populate(vmm_space_t* space, uint64_t start, uint64_t size) {
+    for (uint64_t page = start & ~0xFFFULL; page < start + size; page += PAGE_SIZE) {
+        // Schon gemappt (z.B. Direct-Map Puffer von kmalloc) - braucht keine VMA
+        if (vmm_virt_to_phys(space, page)) {
+            continue;
+        }
+        vmm_vma_t* vma = vmm_find_vma(space, page);
+        if (!vma || !vmm_fault_in(space, vma, page)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Helper: Schreibzugriff auf eine PAGE_COW Page - Frame kopieren oder übernehmen
+static int vmm_cow_fault(vmm_space_t* space, uint64_t page) {
+    pte_t* pte = vmm_get_pte(space, page, 0);
+    if (!pte || !(*pte & PAGE_COW)) {
+        return 0;
+    }
+
+    uint64_t old = *pte;
+    uint64_t phys = old & PTE_ADDR_MASK;
+    page_t* frame_page = pmm_phys_to_page(phys);
+
+    // Verschiebbar bleibt der Frame (bzw. seine Kopie) im Adressraum dieses Faults
+    int movable = frame_page && (frame_page->flags & PG_MOVABLE);
+
+    // Letzter Teilhaber: Frame gehört nur noch diesem Mapping, keine Kopie nötig
+    if (frame_page && frame_page->refcount == 1) {
+        *pte = (old & ~PAGE_COW) | PAGE_WRITE;
+        if (movable) {
+            pmm_page_set_movable((void*)phys, space->pml4_phys, page);
+        }
+        vmm_invlpg(page);
+        tlb_page_flushes++;
+        cow_reuses++;
+        return 1;
+    }
+
+    void* copy = pmm_alloc_page();
+    if (!copy) {
+        return 0;
+    }
+    uint64_t* dst = (uint64_t*)phys_to_virt((uint64_t)copy);
+    const uint64_t* src = (const uint64_t*)phys_to_virt(phys);
+    for (uint64_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        dst[i] = src[i];
+    }
+
+    // Neues Mapping ersetzt das geteilte, dessen Referenz nach dem Flush frei wird
+    uint32_t flags = (uint32_t)(old & 0xFFF & ~(PAGE_COW | PAGE_FRAME_REF)) | PAGE_WRITE;
+    if (old & PAGE_PAT) {
+        // Bit 7 ist im flags-Argument PAGE_HUGE - WC-Mappings bleiben WC
+        flags = (flags & ~(uint32_t)PAGE_PAT) | (uint32_t)PAGE_WC;
+    }
+    if (!vmm_map_pages(space, page, &copy, 1, flags)) {
+        pmm_free_page(copy);
+        return 0;
+    }
+    pmm_free_page(copy);   // Frame gehört jetzt dem Mapping
+    if (movable) {
+        pmm_page_set_movable(copy, space->pml4_phys, page);
+    }
+    cow_copies++;
+    return 1;
+}
+
+int vmm_handle_fault(uint64_t addr, uint64_t err_code) {
+    vmm_space_t* space = addr >= VMM_KERNEL_BASE ? &vmm_kernel_space : vmm_current_space();
+    if (!space) {
+        return 0;
+    }
+
+    // Schutzverletzung: nur Schreiben auf COW-Pages ist erlaubt
+    if (err_code & PF_PRESENT) {
+        return (err_code & PF_WRITE) ? vmm_cow_fault(space, addr & ~0xFFFULL) : 0;
+    }
+
+    vmm_vma_t* vma = vmm_find_vma(space, addr);
+    if (!vma) {
+        return 0;
+    }
+    if ((err_code & PF_WRITE) && !(vma->flags & PAGE_WRITE)) {
+        return 0;
+    }
+    if ((err_code & PF_USER) && !(vma->flags & PAGE_USER)) {
+        return 0;
+    }
+
+    // Schon gemappt (veralteter TLB-Eintrag): nur invalidieren
+    uint64_t page = addr & ~0xFFFULL;
+    if (vmm_virt_to_phys(space, page)) {
+        vmm_invlpg(page);
+        return 1;
+    }
+    return vmm_fault_in(space, vma, page);
+}
+
+uint64_t vmm_demand_faults(void) {
+    return demand_faults;
+}
+
+uint64_t vmm_cow_copies(void) {
+    return cow_copies;
+}
+
+uint64_t vmm_cow_reuses(void) {
+    return cow_reuses;
+}
+
+/*
+ * fork
+ */
+
+// Helper: User-Tabelle src (Ebene level ab virt) nach dst kopieren, Frames COW teilen
+static int vmm_fork_table(vmm_space_t* parent, pte_t* src, pte_t* dst, int level,
+                          uint64_t virt, int* protected) {
+    page_t* dst_page = vmm_table_page(dst);
+
+    for (int i = 0; i < 512; i++) {
+        uint64_t va = virt + (uint64_t)i * VMM_LEVEL_SIZE(level);
+
+        // Nur der User-Bereich (die Identity Map teilt vmm_space_create schon)
+        if (!(src[i] & PAGE_PRESENT) || va + VMM_LEVEL_SIZE(level) <= VMM_USER_BASE) {
+            continue;
+        }
+
+        if (level == 1) {
+            // Auch Pages ohne eigene Referenz (Teile eines aufgeteilten Leafs)
+            // werden geschützt; ihr COW-Fault kopiert dann immer
+            if (src[i] & PAGE_WRITE) {
+                src[i] = (src[i] & ~PAGE_WRITE) | PAGE_COW;
+                *protected = 1;
+            }
+            if (src[i] & PAGE_FRAME_REF) {
+                pmm_page_map((void*)(src[i] & PTE_ADDR_MASK));
+            }
+            dst[i] = src[i];
+            dst_page->pt_entries++;
+            continue;
+        }
+
+        // Große Leaves vorher aufteilen, COW arbeitet mit 4 KB Pages
+        if ((src[i] & PAGE_HUGE) && !vmm_split_leaf(parent, &src[i], level, va)) {
+            return 0;
+        }
+
+        if (!(dst[i] & PAGE_PRESENT)) {
+            uint64_t table = vmm_alloc_table();
+            if (!table) {
+                return 0;
+            }
+            dst[i] = table | (src[i] & ~PTE_ADDR_MASK);
+            dst_page->pt_entries++;
+
+            // Tabelle eines aufgeteilten Leafs: die Kopie hält den Block ebenfalls
+            page_t* src_table = pmm_phys_to_page(src[i] & PTE_ADDR_MASK);
+            if (src_table && src_table->owner) {
+                pmm_page_map((void*)src_table->owner);
+                pmm_phys_to_page(table)->owner = src_table->owner;
+            }
+        }
+
+        if (!vmm_fork_table(parent, (pte_t*)phys_to_virt(src[i] & PTE_ADDR_MASK),
+                            (pte_t*)phys_to_virt(dst[i] & PTE_ADDR_MASK), level - 1, va, protected)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+vmm_space_t* vmm_space_fork(vmm_space_t* parent) {
+    vmm_space_t* child = vmm_space_create();
+    if (!child) {
+        return NULL;
+    }
+
+    // Reservierungen übernehmen (Reihenfolge bleibt sortiert)
+    vmm_vma_t** tail = &child->vmas;
+    for (vmm_vma_t* vma = parent->vmas; vma; vma = vma->next) {
+        vmm_vma_t* copy = (vmm_vma_t*)kmalloc(sizeof(vmm_vma_t));
+        if (!copy) {
+            vmm_space_destroy(child);
+            return NULL;
+        }
+        *copy = *vma;
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+    }
+
+    // Nur die untere Hälfte, die Kernel-Hälfte ist ohnehin geteilt
+    int protected = 0;
+    pte_t* src = (pte_t*)phys_to_virt(parent->pml4_phys);
+    pte_t* dst = (pte_t*)phys_to_virt(child->pml4_phys);
+    int ok = 1;
+    for (int i = 0; i < 256 && ok; i++) {
+        if (!(src[i] & PAGE_PRESENT)) {
+            continue;
+        }
+        if (!(dst[i] & PAGE_PRESENT)) {
+            uint64_t table = vmm_alloc_table();
+            if (!table) {
+                ok = 0;
+                break;
+            }
+            dst[i] = table | (src[i] & ~PTE_ADDR_MASK);
+        }
+        ok = vmm_fork_table(parent, (pte_t*)phys_to_virt(src[i] & PTE_ADDR_MASK),
+                            (pte_t*)phys_to_virt(dst[i] & PTE_ADDR_MASK), 3,
+                            (uint64_t)i << VMM_LEVEL_SHIFT(4), &protected);
+    }
+
+    // Schreibschutz im Eltern-Adressraum wirksam machen (User-Pages sind nicht global)
+    if (protected && vmm_space_needs_flush(parent, 0)) {
+        vmm_flush_tlb();
+        tlb_full_flushes++;
+    }
+
+    if (!ok) {
+        vmm_space_destroy(child);
+        return NULL;
+    }
+    return child;
 }
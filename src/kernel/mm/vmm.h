@@ -10,11 +10,62 @@
 #define PAGE_PRESENT   (1ULL << 0)   // Page ist gemapped
 #define PAGE_WRITE     (1ULL << 1)   // Schreibbar
 #define PAGE_USER      (1ULL << 2)   // User-Mode Zugriff erlaubt
-#define PAGE_NOCACHE   (1ULL << 4)   // Kein Cache (für MMIO)
+#define PAGE_WRITETHROUGH (1ULL << 3) // PWT: Write-Through
+#define PAGE_NOCACHE   (1ULL << 4)   // PCD: Kein Cache (für MMIO)
 #define PAGE_SIZE_2MB  (1ULL << 7)   // 2MB Page (für PD Entries)
+#define PAGE_HUGE      PAGE_SIZE_2MB // PS-Bit: 2MB (PD) bzw. 1GB (PDPT) Leaf
+#define PAGE_PAT       (1ULL << 7)   // PAT-Bit in 4 KB PTEs (gleiche Stelle wie PS)
+#define PAGE_GLOBAL    (1ULL << 8)   // Bleibt bei CR3-Wechsel im TLB (CR4.PGE)
+#define PAGE_PAT_LARGE (1ULL << 12)  // PAT-Bit in 2 MB / 1 GB Leaves
+
+// Software-Bits (von der CPU ignoriert)
+#define PAGE_FRAME_REF (1ULL << 9)   // Mapping hält eine Frame-Referenz (pmm_page_map)
+#define PAGE_COW       (1ULL << 10)  // Copy-on-Write: schreibgeschützt geteilt, Kopie beim Schreiben
+
+/*
+ * Nur im flags-Argument der Map-Funktionen: Write-Combining. Der VMM setzt
+ * dafür je nach Leaf-Ebene PAGE_PAT bzw. PAGE_PAT_LARGE (PAT Index 4).
+ * Ohne PAT fällt das Mapping auf PAGE_NOCACHE zurück.
+ *
+ * PAT-Belegung (Index = PAT:PCD:PWT): 0 WB, 1 WT, 2 UC-, 3 UC wie nach dem
+ * Reset, damit PAGE_WRITETHROUGH/PAGE_NOCACHE ihre Bedeutung behalten;
+ * 4 WC, 5 WT, 6 UC-, 7 UC.
+ */
+#define PAGE_WC        (1ULL << 11)
+
+// Physische Adresse in einem Entry (Bits 12-51)
+#define PTE_ADDR_MASK  0x000FFFFFFFFFF000ULL
 
 // Page Size
 #define PAGE_SIZE 4096
+#define VMM_2MB   0x200000ULL
+#define VMM_1GB   0x40000000ULL
+
+// Ab hier beginnt die Kernel-Hälfte (in jedem Adressraum gleich)
+#define VMM_KERNEL_BASE     0xFFFF800000000000ULL
+
+// User-Bereich eines Adressraums (darunter: geteilte Identity Map des ersten GB)
+#define VMM_USER_BASE       0x0000000040000000ULL
+#define VMM_USER_END        0x0000800000000000ULL
+
+/*
+ * Direct Map: der gesamte physische RAM liegt ab dieser Adresse
+ * (PML4 Index 273, zwischen Heap und vmalloc-Fenster).
+ */
+#define VMM_DIRECT_MAP_BASE 0xFFFF888000000000ULL
+
+// Offset phys -> virt: 0 (Identity Map) bis vmm_init() die Direct Map aufgebaut hat
+extern uint64_t vmm_direct_map_offset;
+
+// Frame über die Direct Map ansprechen
+static inline void* phys_to_virt(uint64_t phys) {
+    return (void*)(phys + vmm_direct_map_offset);
+}
+
+// Umkehrung von phys_to_virt (nur für Direct-Map Adressen, nicht für Heap o.ä.)
+static inline uint64_t virt_to_phys(const void* virt) {
+    return (uint64_t)virt - vmm_direct_map_offset;
+}
 
 // Page Table Indices aus virtueller Adresse extrahieren
 #define PML4_INDEX(addr) (((addr) >> 39) & 0x1FF)
@@ -25,13 +76,164 @@
 // Page Table Entry Struktur
 typedef uint64_t pte_t;
 
-// VMM Functions
+// Ab so vielen Pages ist ein kompletter TLB-Flush (CR3 neu laden) billiger als invlpg je Page
+#define VMM_FLUSH_THRESHOLD 32
+
+// Abgebaute Mappings, die vor dem Freigeben ihrer Frames gesammelt werden
+#define VMM_GATHER_MAX 64
+
+// CR3: Bits 0-11 = PCID (bei CR4.PCIDE), Bit 63 beim Schreiben = TLB dieser PCID behalten
+#define CR3_PCID_MASK  0xFFFULL
+#define CR3_NOFLUSH    (1ULL << 63)
+
+// ASIDs 1..4095 werden vergeben (entspricht der PCID)
+#define VMM_ASID_MAX   4095
+
+/*
+ * Adressraum: PML4 plus ASID. Die ASID gilt nur, solange ihre Generation der
+ * aktuellen Generation der CPU entspricht. Sind alle ASIDs vergeben, beginnt
+ * eine neue Generation (ein globaler TLB-Flush) und jeder Adressraum holt
+ * sich beim nächsten Wechsel eine frische ASID.
+ *
+ * Die Kernel-Hälfte (PML4 256-511) teilen sich alle Adressräume per
+ * Referenz auf dieselben PDPTs; Änderungen dort gelten überall.
+ */
+typedef struct vmm_space {
+    uint64_t pml4_phys;
+    uint64_t asid_generation;
+    uint16_t asid;
+    struct vmm_space* next;      // Liste aller erzeugten Adressräume
+    struct vmm_vma* vmas;        // Reservierte Bereiche, nach Adresse sortiert
+} vmm_space_t;
+
+/*
+ * Virtual Memory Area: reservierter Bereich [start, end), dessen Pages erst
+ * beim ersten Zugriff vom Page Fault Handler alloziert und gemappt werden.
+ * Eine Reservierung kostet bis dahin nur Adressraum.
+ */
+typedef struct vmm_vma {
+    uint64_t start;
+    uint64_t end;
+    uint32_t flags;              // PAGE_* Flags der Mappings
+    uint8_t movable;             // Frames verschiebbar (nur Kernel-Hälfte)
+    struct vmm_vma* next;
+} vmm_vma_t;
+
+// Page Fault Error Code (von der CPU gepusht)
+#define PF_PRESENT  (1 << 0)     // 0 = Page nicht gemappt, 1 = Schutzverletzung
+#define PF_WRITE    (1 << 1)     // Schreibzugriff
+#define PF_USER     (1 << 2)     // Zugriff aus Ring 3
+
+// Adressraum des Kernels (PML4 aus stage2)
+extern vmm_space_t vmm_kernel_space;
+
+// VMM Functions (Adressen der Kernel-Hälfte gehen immer an den Kernel-Adressraum)
 void vmm_init(void);
-void vmm_map_page(uint64_t virt_addr, uint64_t phys_addr, uint32_t flags);
-void vmm_unmap_page(uint64_t virt_addr);
-uint64_t vmm_virt_to_phys(uint64_t virt_addr);
+void vmm_map_page(vmm_space_t* space, uint64_t virt_addr, uint64_t phys_addr, uint32_t flags);
+void vmm_unmap_page(vmm_space_t* space, uint64_t virt_addr);
+uint64_t vmm_virt_to_phys(vmm_space_t* space, uint64_t virt_addr);
 
-// Helper: Hole aktuelles CR3 (PML4 Physical Address)
+/*
+ * Adressraum anlegen: neues PML4 mit geteilter Kernel-Hälfte, User-Bereich leer.
+ * destroy baut alle User-Mappings und eigenen Tabellen ab.
+ */
+vmm_space_t* vmm_space_create(void);
+void vmm_space_destroy(vmm_space_t* space);
+
+// Auf dieser CPU geladener Adressraum
+vmm_space_t* vmm_current_space(void);
+
+/*
+ * Adressraum für fork() duplizieren: User-Tabellen werden kopiert, die
+ * Frames aber geteilt - beschreibbare Pages werden in beiden Adressräumen
+ * schreibgeschützt und PAGE_COW markiert, die Kopie macht erst der Page
+ * Fault beim Schreiben. Kosten hängen also an der Tabellen-, nicht an der
+ * Speichergröße. NULL bei Speichermangel.
+ */
+vmm_space_t* vmm_space_fork(vmm_space_t* parent);
+
+/*
+ * Demand Paging: vmm_reserve legt eine VMA an (0 bei Überschneidung oder
+ * ohne Speicher), vmm_release entfernt sie samt ihren Mappings.
+ * vmm_vma_insert nimmt eine vom Aufrufer gehaltene VMA (z.B. für den Heap,
+ * der selbst noch nicht kmalloc benutzen kann).
+ */
+int vmm_reserve(vmm_space_t* space, uint64_t start, uint64_t size, uint32_t flags);
+int vmm_vma_insert(vmm_space_t* space, vmm_vma_t* vma);
+void vmm_release(vmm_space_t* space, uint64_t start);
+vmm_vma_t* vmm_find_vma(vmm_space_t* space, uint64_t addr);
+
+// Pages in [start, start+size) sofort nachladen (z.B. Kernel-Stacks: ein #PF
+// auf dem eigenen Stack würde zum Double Fault), 1 = alles gemappt
+int vmm_populate(vmm_space_t* space, uint64_t start, uint64_t size);
+
+// #PF behandeln: 1 = Page nachgeladen, 0 = echter Fehler
+int vmm_handle_fault(uint64_t addr, uint64_t err_code);
+
+// Per Page Fault nachgeladene Pages / bei COW kopierte bzw. übernommene Pages
+uint64_t vmm_demand_faults(void);
+uint64_t vmm_cow_copies(void);
+uint64_t vmm_cow_reuses(void);
+
+/*
+ * Range API: ein Table-Walk pro Page Table statt pro Page und ein
+ * gemeinsamer TLB-Flush am Ende (über VMM_FLUSH_THRESHOLD: CR3 neu laden).
+ * vmm_map_range nimmt für ausgerichtete Teile 2 MB / 1 GB Leaves; wird
+ * nur ein Teil eines Leafs geändert, wird es vorher aufgeteilt.
+ * map: 1 = erfolgreich, 0 = keine Page Table (Teil-Mapping wird zurückgenommen)
+ */
+int vmm_map_range(vmm_space_t* space, uint64_t virt_addr, uint64_t phys_addr,
+                  uint64_t size, uint32_t flags);
+int vmm_map_pages(vmm_space_t* space, uint64_t virt_addr, void* const* frames,
+                  uint64_t count, uint32_t flags);
+void vmm_unmap_range(vmm_space_t* space, uint64_t virt_addr, uint64_t size);
+
+/*
+ * Wie vmm_unmap_range, aber ohne TLB-Flush und ohne leere Tabellen
+ * freizugeben. Der Aufrufer muss die Frames selbst referenziert halten und
+ * vor ihrer Freigabe bzw. der Wiederverwendung des Bereichs flushen
+ * (vmm_flush_tlb_global) - so lassen sich viele Unmaps in einem Flush bündeln.
+ */
+void vmm_unmap_range_lazy(vmm_space_t* space, uint64_t virt_addr, uint64_t size);
+
+// TLB Statistik: komplette Flushes / einzeln invalidierte Pages
+uint64_t vmm_tlb_full_flushes(void);
+uint64_t vmm_tlb_page_flushes(void);
+
+/*
+ * Supervisor-Mappings in der Kernel-Hälfte werden global angelegt und
+ * überleben CR3-Wechsel. vmm_flush_tlb verwirft nur nicht-globale Einträge
+ * (wie ein Adressraum-Wechsel), vmm_flush_tlb_global alle.
+ */
+int vmm_global_enabled(void);
+void vmm_flush_tlb(void);
+void vmm_flush_tlb_global(void);
+
+// Adressraum laden; mit PCID ohne Flush, solange seine ASID noch gültig ist
+void vmm_switch_space(vmm_space_t* space);
+
+// PCID Statistik: aktiv?, CR3-Wechsel gesamt / davon ohne Flush
+int vmm_pcid_enabled(void);
+uint64_t vmm_cr3_switches(void);
+uint64_t vmm_cr3_noflush_switches(void);
+
+// Große Leaves: angelegte / aufgeteilte, 1 GB Pages verfügbar?
+uint64_t vmm_huge_maps(void);
+uint64_t vmm_leaf_splits(void);
+
+// PAT mit Write-Combining Eintrag programmiert?
+int vmm_pat_enabled(void);
+
+// Page-Table Frames in Benutzung / leer geworden und an den PMM zurückgegeben
+uint64_t vmm_pt_frames(void);
+uint64_t vmm_pt_reclaimed(void);
+int vmm_has_1gb_pages(void);
+
+// Mapping von old_phys auf new_phys im Adressraum mit dem PML4 pml4_phys
+// umbiegen (Flags bleiben), 1 = erfolgreich
+int vmm_migrate_page(uint64_t pml4_phys, uint64_t virt_addr, uint64_t old_phys, uint64_t new_phys);
+
+// Helper: Hole aktuelles CR3 (PML4 Physical Address, mit PCID in Bits 0-11)
 static inline uint64_t vmm_get_cr3(void) {
     uint64_t cr3;
     __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
@@ -43,6 +245,13 @@ static inline void vmm_set_cr3(uint64_t cr3) {
     __asm__ volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
 }
 
+// Helper: Fehleradresse des letzten Page Faults
+static inline uint64_t vmm_get_cr2(void) {
+    uint64_t cr2;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+    return cr2;
+}
+
 // Helper: TLB flush für eine Adresse
 static inline void vmm_invlpg(uint64_t addr) {
     __asm__ volatile("invlpg (%0)" :: "r"(addr) : "memory");
@@ -5,42 +5,30 @@
 #include "gdt.h"
 #include "vga.h"
 #include "string.h"
+#include "task.h"
+#include "cpu.h"
 
 // MSR Adressen
 #define MSR_GS_BASE         0xC0000101
 #define MSR_KERNEL_GS_BASE  0xC0000102
 
-// MSR Hilfsfunktionen
-static inline uint64_t rdmsr(uint32_t msr) {
-    uint32_t lo, hi;
-    asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
-    return ((uint64_t)hi << 32) | lo;
-}
-
-static inline void wrmsr(uint32_t msr, uint64_t value) {
-    uint32_t lo = value & 0xFFFFFFFF;
-    uint32_t hi = value >> 32;
-    asm volatile ("wrmsr" : : "a"(lo), "d"(hi), "c"(msr));
-}
-
-// Per-CPU Daten Struktur (für swapgs)
-// Diese Struktur wird über GS-Segment adressiert
-typedef struct {
-    uint64_t kernel_stack;      // Offset 0x00: Kernel Stack Pointer (RSP0)
-    uint64_t user_stack;        // Offset 0x08: Gespeicherter User Stack
-    uint64_t current_task;      // Offset 0x10: Pointer zum aktuellen Task (optional)
-} __attribute__((packed)) cpu_data_t;
-
 // Statische Per-CPU Daten (für Single-CPU System)
 static cpu_data_t cpu_data __attribute__((aligned(16)));
 
+// Per-CPU Daten der aktuellen CPU
+// Single-CPU: es gibt genau eine Instanz. Mit SMP wird das ein Lookup über
+// die CPU-ID bzw. GS - die Aufrufer bleiben gleich.
+cpu_data_t* cpu_current(void) {
+    return &cpu_data;
+}
+
 // Debug: Adresse der cpu_data Struktur abrufen
 uint64_t syscall_get_cpu_data_addr(void) {
     return (uint64_t)&cpu_data;
 }
 
 void syscall_init(void) {
-    // cpu_data explizit initialisieren
+    // cpu_data explizit initialisieren (pmm_cache und heap_cache gehören PMM/Heap und bleiben)
     cpu_data.kernel_stack = 0;
     cpu_data.user_stack = 0;
     cpu_data.current_task = 0;
@@ -77,22 +65,19 @@ void syscall_init(void) {
     wrmsr(MSR_SFMASK, SFMASK_IF | SFMASK_TF | SFMASK_DF);
 
     // 5. GS Base für swapgs konfigurieren
-    // KORREKTE Reihenfolge laut OSDev Wiki:
-    //
-    // - GS_BASE = 0 (User GS, leer - wird vom User genutzt)
-    // - KERNEL_GS_BASE = &cpu_data (Kernel per-CPU Struktur)
+    // Im Kernel zeigt GS_BASE immer auf cpu_data, die User-GS (0) liegt
+    // solange in KERNEL_GS_BASE. Jeder Übergang von/nach Ring 3 tauscht:
     //
-    // Ablauf:
-    // 1. Kernel initialisiert: GS_BASE=0, KERNEL_GS_BASE=&cpu_data
-    // 2. jump_to_usermode: KEIN swapgs nötig (GS_BASE ist schon 0 für User)
-    // 3. User macht syscall -> syscall_entry:
-    //    - swapgs: GS_BASE=&cpu_data, KERNEL_GS_BASE=0
-    //    - Jetzt funktioniert [gs:0x00] für Kernel-Stack!
-    // 4. sysret -> swapgs zurück:
-    //    - GS_BASE=0 (User), KERNEL_GS_BASE=&cpu_data (Kernel)
+    // 1. Kernel initialisiert: GS_BASE=&cpu_data, KERNEL_GS_BASE=0
+    // 2. jump_to_usermode / iretq aus den ISR-Stubs nach Ring 3: swapgs
+    // 3. syscall_entry und ISR/IRQ-Stubs aus Ring 3: swapgs
+    //    - GS_BASE=&cpu_data, [gs:0x00] liefert den Kernel-Stack
+    // 4. sysret: swapgs zurück
     //
-    wrmsr(MSR_GS_BASE, 0);                    // User GS = 0
-    wrmsr(MSR_KERNEL_GS_BASE, (uint64_t)&cpu_data);  // Kernel GS = cpu_data
+    // Damit ist egal, über welchen Weg ein Task den Kernel betreten hat und
+    // über welchen ein anderer Task ihn nach einem Task-Switch verlässt.
+    wrmsr(MSR_GS_BASE, (uint64_t)&cpu_data);  // Kernel GS = cpu_data
+    wrmsr(MSR_KERNEL_GS_BASE, 0);             // User GS = 0
 }
 
 // Setzt den Kernel-Stack in der Per-CPU Struktur
@@ -100,13 +85,51 @@ void syscall_set_kernel_stack(uint64_t stack_top) {
     cpu_data.kernel_stack = stack_top;
 }
 
+// fork: Kind mit COW-Kopie des Adressraums, kehrt mit rax = 0 aus dem Syscall zurück
+static uint64_t sys_fork(const syscall_frame_t* frame) {
+    task_t* parent = task_get_current();
+    if (!parent || parent->space == &vmm_kernel_space) {
+        return (uint64_t)-1;  // Nur User-Prozesse mit eigenem Adressraum
+    }
+
+    vmm_space_t* space = vmm_space_fork(parent->space);
+    if (!space) {
+        return (uint64_t)-1;
+    }
+
+    // Zustand nach dem syscall: RIP/RFLAGS/RSP und die erhaltenen Register
+    registers_t regs;
+    memset(&regs, 0, sizeof(regs));
+    regs.rip = frame->rip;
+    regs.rsp = frame->rsp;
+    regs.rflags = frame->rflags;
+    regs.rbx = frame->rbx;
+    regs.rbp = frame->rbp;
+    regs.r12 = frame->r12;
+    regs.r13 = frame->r13;
+    regs.r14 = frame->r14;
+    regs.r15 = frame->r15;
+    regs.rax = 0;
+
+    task_t* child = task_create_user(parent->name, space, &regs);
+    if (!child) {
+        vmm_space_destroy(space);
+        return (uint64_t)-1;
+    }
+    return child->pid;
+}
+
 // Der eigentliche Syscall Handler (wird von Assembly aufgerufen)
-// Argumente kommen via Register: rdi=syscall_num, rsi=arg1, rdx=arg2, rcx=arg3
-uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2, uint64_t arg3) {
+// Argumente kommen via Register: rdi=syscall_num, rsi=arg1, rdx=arg2, rcx=arg3,
+// r8 = gesicherter User-Zustand
+uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                         syscall_frame_t* frame) {
     switch (syscall_num) {
         case SYS_EXIT:
-            // Exit: Halt the system (in single-task mode)
-            while (1) { asm volatile ("hlt"); }
+            // Exit: Task beenden und sofort zum nächsten wechseln, der
+            // Idle-Task gibt ihn danach frei (task_reap)
+            task_exit();
+            while (1) { asm volatile ("hlt"); }  // Nur ohne anderen lauffähigen Task
             return 0;
 
         case SYS_WRITE:
@@ -128,6 +151,9 @@ uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2, uin
             // TODO: Task yielden
             return 0;
 
+        case SYS_FORK:
+            return sys_fork(frame);
+
         default:
             // Unknown syscall
             return (uint64_t)-1;
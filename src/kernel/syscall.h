@@ -5,6 +5,8 @@
 #define KIOS_SYSCALL_H
 
 #include "types.h"
+#include "mm/pmm.h"
+#include "mm/heap.h"
 
 // MSR Adressen für syscall/sysret
 #define MSR_EFER        0xC0000080  // Extended Feature Enable Register
@@ -26,6 +28,24 @@
 #define SYS_WRITE       1
 #define SYS_READ        2
 #define SYS_YIELD       3
+#define SYS_FORK        4
+
+// Per-CPU Daten Struktur (für swapgs)
+// Diese Struktur wird über GS-Segment adressiert - die Offsets 0x00 und 0x08
+// werden von syscall_asm.asm genutzt und dürfen sich nicht verschieben!
+typedef struct {
+    uint64_t kernel_stack;      // Offset 0x00: Kernel Stack Pointer (RSP0)
+    uint64_t user_stack;        // Offset 0x08: Gespeicherter User Stack
+    uint64_t current_task;      // Offset 0x10: Pointer zum aktuellen Task (optional)
+    pmm_cpu_cache_t pmm_cache;  // Offset 0x18: Lokaler Page-Frame Cache (PMM)
+    uint64_t asid_generation;   // Aktuelle ASID-Generation dieser CPU (VMM)
+    uint64_t asid_next;         // Nächste freie ASID in der Generation
+    uint64_t active_space;      // Pointer zum geladenen Adressraum (vmm_space_t)
+    heap_cpu_cache_t heap_cache; // kmalloc Magazine (Heap)
+} __attribute__((packed)) cpu_data_t;
+
+// Per-CPU Daten der aktuellen CPU
+cpu_data_t* cpu_current(void);
 
 // Syscall Init
 void syscall_init(void);
@@ -33,8 +53,17 @@ void syscall_init(void);
 // Setzt den Kernel-Stack für syscall (in Per-CPU Daten)
 void syscall_set_kernel_stack(uint64_t stack_top);
 
+// Vom syscall_entry auf den Kernel-Stack gesicherter User-Zustand
+typedef struct {
+    uint64_t r15, r14, r13, r12, rbp, rbx;
+    uint64_t rflags;            // User RFLAGS (aus R11)
+    uint64_t rip;               // User RIP (aus RCX)
+    uint64_t rsp;               // User RSP
+} __attribute__((packed)) syscall_frame_t;
+
 // Syscall Handler (wird von Assembly aufgerufen)
-uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2, uint64_t arg3);
+uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                         syscall_frame_t* frame);
 
 // Assembly Entry Point (definiert in syscall_asm.asm)
 extern void syscall_entry(void);
@@ -25,7 +25,10 @@ syscall_entry:
     ; Kernel-RSP aus cpu_data.kernel_stack laden [gs:0x00]
     mov rsp, [gs:0x00]
 
-    ; Register sichern
+    ; Register sichern (Layout = syscall_frame_t, von unten nach oben).
+    ; Der User-RSP kommt mit auf den Stack: wird der Task im Handler
+    ; unterbrochen, überschreibt ein anderer Task [gs:0x08]
+    push qword [gs:0x08]    ; User RSP
     push rcx                ; User RIP (von syscall in RCX gelegt)
     push r11                ; User RFLAGS (von syscall in R11 gelegt)
     push rbx
@@ -42,10 +45,13 @@ syscall_entry:
     mov rdx, rsi            ; arg2 -> rdx (3. C Argument)
     mov rsi, rdi            ; arg1 -> rsi (2. C Argument)
     mov rdi, rax            ; syscall_num -> rdi (1. C Argument)
+    mov r8, rsp             ; syscall_frame_t* -> r8 (5. C Argument)
+    sub rsp, 8              ; Stack vor dem call auf 16 Bytes ausrichten
 
     sti                     ; Interrupts erlauben während Handler läuft
     call syscall_handler
     cli                     ; Interrupts aus für sysret
+    add rsp, 8
 
     ; Register wiederherstellen
     pop r15
@@ -58,7 +64,7 @@ syscall_entry:
     pop rcx                 ; User RIP
 
     ; User-RSP wiederherstellen
-    mov rsp, [gs:0x08]
+    pop rsp
 
     ; swapgs zurück: GS_BASE und KERNEL_GS_BASE wieder tauschen
     ;   GS_BASE = 0 (User)
@@ -75,11 +81,11 @@ syscall_entry:
 ; =============================================================================
 ; Springt von Ring 0 nach Ring 3 via IRETQ
 ;
-; Die MSRs sind beim Aufruf:
-;   GS_BASE = 0 (schon für User vorbereitet!)
-;   KERNEL_GS_BASE = &cpu_data (für späteren syscall)
+; Die MSRs sind beim Aufruf (Kernel-Konvention):
+;   GS_BASE = &cpu_data
+;   KERNEL_GS_BASE = 0 (User GS)
 ;
-; Daher brauchen wir hier KEIN swapgs!
+; Vor dem iretq also swapgs, damit Ring 3 mit der User-GS startet.
 
 global jump_to_usermode
 jump_to_usermode:
@@ -103,5 +109,5 @@ jump_to_usermode:
     push 0x23               ; CS (User Code 0x20 | RPL 3)
     push rsi                ; RIP (user_rip aus Parameter)
 
-    ; KEIN swapgs nötig - MSRs sind schon korrekt für User!
+    swapgs                  ; GS_BASE = 0 (User), KERNEL_GS_BASE = &cpu_data
     iretq
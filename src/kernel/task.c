@@ -9,6 +9,14 @@
 #include "pit.h"
 #include "vga.h"
 #include "string.h"
+#include "tss.h"
+#include "syscall.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "idt.h"
+
+// Kernel-Stack für Tasks, die in Ring 3 laufen
+#define TASK_KERNEL_STACK_SIZE 8192
 
 /* =============================================================================
  * Globale Variablen
@@ -19,6 +27,15 @@ static task_t *task_list[MAX_TASKS];  // Array aller Tasks
 static int task_count_val = 0;         // Anzahl Tasks
 static task_t *current_task = NULL;    // Aktuell laufender Task
 static uint32_t next_pid = 1;          // Nächste verfügbare PID
+static kmem_cache_t *task_cache = NULL;  // TCBs (im Grundzustand vorkonstruiert)
+
+// Register-Frame eines neuen Kernel-Threads, nur rip und rsp kommen dazu
+static const registers_t kernel_regs_template = {
+    .gs = 0x10, .fs = 0x10, .es = 0x10, .ds = 0x10,   // Kernel Data Segment
+    .cs = 0x08,                                       // Kernel Code Segment
+    .ss = 0x10,                                       // Kernel Stack Segment
+    .rflags = 0x202,                                  // Interrupts enabled
+};
 
 /* =============================================================================
  * Private Helper Functions
@@ -43,6 +60,26 @@ static void task_wrapper(void) {
     task_exit();
 }
 
+/**
+ * task_ctor - Grundzustand eines TCBs im task_cache
+ *
+ * Läuft nur beim ersten Anlegen eines Objekts. Wer einen TCB zurückgibt,
+ * muss ihn in diesem Zustand hinterlassen.
+ */
+static void task_ctor(void *obj) {
+    task_t *task = (task_t*)obj;
+    task->pid = 0;
+    task->name[0] = '\0';
+    task->state = TASK_STATE_READY;
+    task->regs = NULL;
+    task->stack_base = 0;
+    task->stack_size = 0;
+    task->sleep_until = 0;
+    task->space = &vmm_kernel_space;  // Kernel-Threads teilen sich den Kernel-Adressraum
+    task->kernel_stack_top = 0;
+    task->next = NULL;
+}
+
 /* =============================================================================
  * Public Functions
  * =============================================================================
@@ -61,18 +98,17 @@ void task_init(void) {
     current_task = NULL;
     next_pid = 1;
 
+    if (!task_cache) {
+        task_cache = kmem_cache_create("task_t", sizeof(task_t), KMEM_CACHE_LINE, task_ctor);
+    }
+
     // Erstelle einen TCB für den aktuellen Kernel-Kontext (kernel_main)
     // Dieser wird zum "Idle Task" wenn der Scheduler aktiviert wird
-    task_t *kernel_task = (task_t*)kmalloc(sizeof(task_t));
+    // PID 0, Boot-Stack, regs werden beim ersten Switch gesetzt (alles aus task_ctor)
+    task_t *kernel_task = (task_t*)kmem_cache_alloc(task_cache);
     if (kernel_task) {
-        kernel_task->pid = 0;  // PID 0 für Kernel
         strncpy(kernel_task->name, "kernel_idle", TASK_NAME_MAX);
         kernel_task->state = TASK_STATE_RUNNING;
-        kernel_task->stack_base = 0;  // Nutzt den Boot-Stack
-        kernel_task->stack_size = 0;
-        kernel_task->regs = NULL;  // Wird beim ersten Switch gesetzt
-        kernel_task->sleep_until = 0;
-        kernel_task->next = NULL;
 
         task_list[task_count_val++] = kernel_task;
         current_task = kernel_task;
@@ -85,13 +121,16 @@ void task_init(void) {
  * task_create - Erstellt einen neuen Task
  */
 task_t* task_create(const char *name, void (*entry)(void), uint64_t stack_size) {
+    // Der Idle-Task läuft nur ohne lauffähige Tasks - Zombies hier spätestens aufräumen
+    task_reap();
+
     if (task_count_val >= MAX_TASKS) {
         vga_println("[TASK] ERROR: Max tasks reached!");
         return NULL;
     }
 
-    // TCB allokieren
-    task_t *task = (task_t*)kmalloc(sizeof(task_t));
+    // TCB allokieren (kommt im Grundzustand aus dem Cache)
+    task_t *task = (task_t*)kmem_cache_alloc(task_cache);
     if (!task) {
         vga_println("[TASK] ERROR: Failed to allocate TCB!");
         return NULL;
@@ -101,18 +140,24 @@ task_t* task_create(const char *name, void (*entry)(void), uint64_t stack_size)
     void *stack = kmalloc(stack_size);
     if (!stack) {
         vga_println("[TASK] ERROR: Failed to allocate stack!");
-        kfree(task);
+        kmem_cache_free(task_cache, task);
+        return NULL;
+    }
+
+    // Heap-Pages kommen erst beim ersten Zugriff - ein #PF auf dem eigenen
+    // Stack ließe sich aber nicht mehr behandeln, also sofort mappen
+    if (!vmm_populate(&vmm_kernel_space, (uint64_t)stack, stack_size)) {
+        vga_println("[TASK] ERROR: Failed to map stack!");
+        kfree(stack);
+        kmem_cache_free(task_cache, task);
         return NULL;
     }
 
-    // TCB initialisieren
+    // TCB initialisieren (Rest steht schon aus task_ctor)
     task->pid = next_pid++;
     strncpy(task->name, name, TASK_NAME_MAX);
-    task->state = TASK_STATE_READY;
     task->stack_base = (uint64_t)stack;
     task->stack_size = stack_size;
-    task->sleep_until = 0;
-    task->next = NULL;
 
     // Register-State auf dem Stack vorbereiten
     // Stack wächst nach unten, also starten wir am Ende
@@ -125,46 +170,10 @@ task_t* task_create(const char *name, void (*entry)(void), uint64_t stack_size)
     stack_top -= sizeof(registers_t);
     task->regs = (registers_t*)stack_top;
 
-    // Register-State initialisieren
-    registers_t *regs = task->regs;
-
-    // Alle Register auf 0
-    regs->rax = 0;
-    regs->rbx = 0;
-    regs->rcx = 0;
-    regs->rdx = 0;
-    regs->rsi = 0;
-    regs->rdi = 0;
-    regs->rbp = 0;
-    regs->r8 = 0;
-    regs->r9 = 0;
-    regs->r10 = 0;
-    regs->r11 = 0;
-    regs->r12 = 0;
-    regs->r13 = 0;
-    regs->r14 = 0;
-    regs->r15 = 0;
-
-    // Instruction Pointer auf Entry-Funktion setzen
-    regs->rip = (uint64_t)entry;
-
-    // Stack Pointer
-    regs->rsp = stack_top;
-
-    // Segments (Kernel-Segmente)
-    regs->cs = 0x08;   // Kernel Code Segment
-    regs->ds = 0x10;   // Kernel Data Segment
-    regs->es = 0x10;
-    regs->fs = 0x10;
-    regs->gs = 0x10;
-    regs->ss = 0x10;   // Kernel Stack Segment
-
-    // Flags (Interrupts enabled)
-    regs->rflags = 0x202;
-
-    // Interrupt Nummer und Error Code (nicht relevant für Task)
-    regs->int_no = 0;
-    regs->err_code = 0;
+    // Register-State aus der Vorlage: GPRs 0, Kernel-Segmente, Interrupts an
+    *task->regs = kernel_regs_template;
+    task->regs->rip = (uint64_t)entry;
+    task->regs->rsp = stack_top;
 
     // Task zur Liste hinzufügen
     task_list[task_count_val++] = task;
@@ -178,6 +187,55 @@ task_t* task_create(const char *name, void (*entry)(void), uint64_t stack_size)
     return task;
 }
 
+/**
+ * task_create_user - Erstellt einen Task, der in Ring 3 weiterläuft
+ */
+task_t* task_create_user(const char *name, vmm_space_t *space, const registers_t *user_regs) {
+    task_reap();
+
+    if (task_count_val >= MAX_TASKS) {
+        vga_println("[TASK] ERROR: Max tasks reached!");
+        return NULL;
+    }
+
+    task_t *task = (task_t*)kmem_cache_alloc(task_cache);
+    void *stack = task ? kmalloc(TASK_KERNEL_STACK_SIZE) : NULL;
+    if (!stack || !vmm_populate(&vmm_kernel_space, (uint64_t)stack, TASK_KERNEL_STACK_SIZE)) {
+        vga_println("[TASK] ERROR: Failed to allocate kernel stack!");
+        kfree(stack);
+        kmem_cache_free(task_cache, task);
+        return NULL;
+    }
+
+    // TCB initialisieren (Rest steht schon aus task_ctor)
+    task->pid = next_pid++;
+    strncpy(task->name, name, TASK_NAME_MAX);
+    task->stack_base = (uint64_t)stack;
+    task->stack_size = TASK_KERNEL_STACK_SIZE;
+    task->space = space;
+    task->kernel_stack_top = ((uint64_t)stack + TASK_KERNEL_STACK_SIZE) & ~0xFULL;
+
+    // Register-Frame oben auf dem Kernel-Stack: iretq springt damit nach Ring 3
+    task->regs = (registers_t*)(task->kernel_stack_top - sizeof(registers_t));
+    *task->regs = *user_regs;
+    task->regs->cs = GDT_USER_CODE_RPL3;
+    task->regs->ss = GDT_USER_DATA_RPL3;
+    task->regs->ds = GDT_USER_DATA_RPL3;
+    task->regs->es = GDT_USER_DATA_RPL3;
+    task->regs->fs = 0;
+    task->regs->gs = 0;
+    task->regs->rflags |= 0x202;  // Interrupts an, Reserved Bit 1
+    task->regs->int_no = 0;
+    task->regs->err_code = 0;
+
+    // Erst vollständig aufgesetzt in die Liste, der Scheduler kann jederzeit zugreifen
+    uint64_t flags = cpu_irq_save();
+    task_list[task_count_val++] = task;
+    cpu_irq_restore(flags);
+
+    return task;
+}
+
 /**
  * task_get_current - Gibt aktuellen Task zurück
  */
@@ -234,17 +292,31 @@ registers_t* task_switch(registers_t *current_regs) {
         }
     }
 
-    // Kein READY Task gefunden? Behalte aktuellen
+    // Kein READY Task gefunden? Zum Idle-Task (PID 0) wechseln, falls der
+    // aktuelle Task nicht mehr laufen kann - sonst aktuellen behalten
     if (!next_task) {
-        if (current_task) {
-            current_task->state = TASK_STATE_RUNNING;
+        task_t *idle = task_list[0];
+        if (current_task && current_task != idle && current_task->state != TASK_STATE_READY &&
+            idle && idle->pid == 0 && idle->regs) {
+            next_task = idle;
+        } else {
+            if (current_task) {
+                current_task->state = TASK_STATE_RUNNING;
+            }
+            return current_regs;
         }
-        return current_regs;
     }
 
-    // Zu neuem Task wechseln
+    // Zu neuem Task wechseln (CR3 nur bei anderem Adressraum, mit PCID ohne Flush)
     current_task = next_task;
     current_task->state = TASK_STATE_RUNNING;
+    vmm_switch_space(current_task->space);
+
+    // Interrupts und Syscalls aus Ring 3 landen auf dem Kernel-Stack des Tasks
+    if (current_task->kernel_stack_top) {
+        tss_set_kernel_stack(current_task->kernel_stack_top);
+        syscall_set_kernel_stack(current_task->kernel_stack_top);
+    }
 
     return current_task->regs;
 }
@@ -265,13 +337,51 @@ void task_sleep(uint64_t ticks) {
  */
 void task_exit(void) {
     if (current_task) {
+        // Freigeben kann erst task_reap, solange laufen wir noch auf dem Stack
         current_task->state = TASK_STATE_ZOMBIE;
-        // TODO: Stack und TCB freigeben
-        // TODO: Aus task_list entfernen
-        // Erstmal nur als Zombie markieren
+        task_yield();
+    }
+}
+
+/**
+ * task_reap - Beendete Tasks freigeben
+ */
+void task_reap(void) {
+    for (;;) {
+        // Zombie aus der Liste nehmen, danach sieht ihn der Scheduler nicht mehr
+        uint64_t flags = cpu_irq_save();
+        task_t *zombie = NULL;
+        for (int i = 0; i < task_count_val; i++) {
+            if (task_list[i]->state == TASK_STATE_ZOMBIE && task_list[i] != current_task) {
+                zombie = task_list[i];
+                for (int j = i; j < task_count_val - 1; j++) {
+                    task_list[j] = task_list[j + 1];
+                }
+                task_list[--task_count_val] = NULL;
+                break;
+            }
+        }
+        cpu_irq_restore(flags);
+
+        if (!zombie) {
+            return;
+        }
+
+        // Eigener Adressraum (fork, usertest) samt COW-Referenzen, Stack und TCB
+        vmm_space_destroy(zombie->space);
+        kfree((void*)zombie->stack_base);
+        task_ctor(zombie);
+        kmem_cache_free(task_cache, zombie);
     }
 }
 
+/**
+ * task_yield - CPU an den nächsten Task abgeben
+ */
+void task_yield(void) {
+    asm volatile ("int %0" : : "i"(TASK_YIELD_VECTOR) : "memory");
+}
+
 /**
  * task_count - Gibt Anzahl Tasks zurück
  */
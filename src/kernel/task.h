@@ -9,6 +9,7 @@
 
 #include "types.h"
 #include "isr.h"
+#include "mm/vmm.h"
 
 /* =============================================================================
  * Task States
@@ -48,6 +49,9 @@ typedef struct task {
 
     uint64_t sleep_until;            // Tick-Count bis Task aufwacht (bei SLEEPING)
 
+    vmm_space_t *space;              // Adressraum (CR3 + ASID) des Tasks
+    uint64_t kernel_stack_top;       // RSP0 für Interrupts/Syscalls aus Ring 3 (0 = reiner Kernel-Task)
+
     struct task *next;               // Nächster Task in der Queue (für Round-Robin)
 } task_t;
 
@@ -71,6 +75,20 @@ void task_init(void);
  */
 task_t* task_create(const char *name, void (*entry)(void), uint64_t stack_size);
 
+/**
+ * task_create_user - Erstellt einen Task, der in Ring 3 weiterläuft
+ *
+ * Der Task bekommt einen eigenen Kernel-Stack; beim ersten Switch kehrt
+ * er per iretq mit dem Register-Zustand user_regs (rip, rsp, rflags und
+ * allgemeine Register) in space zurück. Segmente setzt die Funktion.
+ *
+ * @param name Task-Name
+ * @param space Adressraum des Tasks
+ * @param user_regs Register-Zustand in Ring 3
+ * @return Pointer zum neuen Task oder NULL bei Fehler
+ */
+task_t* task_create_user(const char *name, vmm_space_t *space, const registers_t *user_regs);
+
 /**
  * task_get_current - Gibt den aktuell laufenden Task zurück
  *
@@ -95,9 +113,30 @@ void task_sleep(uint64_t ticks);
 
 /**
  * task_exit - Beendet den aktuellen Task
+ *
+ * Markiert ihn als Zombie und wechselt zum nächsten Task. Kehrt nur zurück,
+ * wenn kein anderer Task lauffähig ist.
  */
 void task_exit(void);
 
+/**
+ * task_reap - Gibt beendete Tasks frei (Idle Loop, task_create*)
+ *
+ * Entfernt Zombies aus der Task-Liste und gibt ihren Adressraum (gehört
+ * dem Task, sofern es nicht der Kernel-Adressraum ist), ihren Stack und
+ * den TCB frei.
+ */
+void task_reap(void);
+
+/**
+ * task_yield - Gibt die CPU sofort an den nächsten Task ab
+ *
+ * Läuft über TASK_YIELD_VECTOR durch den IRQ-Stub und kehrt zurück, sobald
+ * der Task wieder ausgewählt wird (nach task_exit nie). Ohne anderen
+ * lauffähigen Task kehrt die Funktion direkt zurück.
+ */
+void task_yield(void);
+
 /**
  * task_count - Gibt Anzahl der Tasks zurück
  *